@@ -0,0 +1,600 @@
+// -*- mode: c -*-
+/****************************************************************
+COPYRIGHT_BEGIN
+Copyright (C) 2015, cobaro.org
+All rights reserved.
+COPYRIGHT_END
+****************************************************************/
+
+// Benchmarks for the claim/publish/format/write pipeline.
+//
+// Results are written to stdout as one JSON object per line, so that
+// runs against different releases can be compared mechanically.
+// Progress and errors go to stderr.
+
+// Defining _XOPENS_SOURCE to 700 means:
+//   we get __USE_OPEN2K defined for pthread_spinlock*
+//   we get _POSIX_C_SOURCE defined sufficiently to get nanosleep/timespec
+#ifndef _XOPEN_SOURCE
+# define _XOPEN_SOURCE 700
+#endif
+
+#include "config.h"
+#include "libcobaro-log0/log.h"
+
+#if defined(HAVE_PTHREAD_H)
+# include <pthread.h>
+#endif
+
+#include <sched.h>
+
+#if defined(HAVE_SYS_PARAM_H)
+# include <sys/param.h>
+#endif
+
+#if defined(HAVE_TIME_H)
+# include <time.h>
+#endif
+
+#if defined(HAVE_UNISTD_H)
+# include <unistd.h>
+#endif
+
+#define UNUSED(x) ((void)(x))
+
+#define DEFAULT_ITERATIONS (1000000)
+#define DEFAULT_THREADS_MAX (8)
+#define DEFAULT_RATE (5000) // per producer per second, for slow_sink
+#define DEFAULT_SINK_DELAY (100) // microseconds per message, for slow_sink
+#define DEFAULT_SECONDS (2) // per backpressure setting, for slow_sink
+#define RETRY_LIMIT (100) // claim attempts with 'retry' backpressure
+
+/// Message shapes to benchmark formatting with.
+enum bench_message_ids {
+    BENCH_MSG_LITERAL = 0,
+    BENCH_MSG_STRING,
+    BENCH_MSG_MIXED,
+    BENCH_MSG_WIDE,
+    BENCH_MSG_LONG,
+
+    BENCH_MSG_COUNT
+};
+
+static char *bench_messages[BENCH_MSG_COUNT + 1] = {
+    // BENCH_MSG_LITERAL
+    "Nothing to substitute here",
+
+    // BENCH_MSG_STRING
+    "Peer %1 disconnected",
+
+    // BENCH_MSG_MIXED
+    "s:%1, i:%2, f:%3, ip:%4",
+
+    // BENCH_MSG_WIDE
+    "%1 %2 %3 %4 %5 %6 %7 %8",
+
+    // BENCH_MSG_LONG
+    "A message template with a good deal of literal text around its "
+    "parameters, %1 and %2, which is more like what real applications "
+    "write when they explain themselves to an operator at %3.",
+
+    ""
+};
+
+static const char *bench_message_names[BENCH_MSG_COUNT] = {
+    "literal", "string", "mixed", "wide", "long"
+};
+
+/// What a producer does when the pool is empty.
+enum backpressure {
+    BACKPRESSURE_DROP = 0,  // give up at once
+    BACKPRESSURE_RETRY,  // yield and retry, up to RETRY_LIMIT times
+    BACKPRESSURE_BLOCK,  // yield and retry until successful
+
+    BACKPRESSURE_COUNT
+};
+
+static const char *backpressure_names[BACKPRESSURE_COUNT] = {
+    "drop", "retry", "block"
+};
+
+static const char *lock_names[COBARO_LOG_LOCKS_COUNT] = {
+    "ttas", "ticket"
+};
+
+static long iterations = DEFAULT_ITERATIONS;
+static int threads_max = DEFAULT_THREADS_MAX;
+static long rate = DEFAULT_RATE;
+static long sink_delay = DEFAULT_SINK_DELAY;
+static long seconds = DEFAULT_SECONDS;
+static struct cobaro_log_options options;
+
+
+// Monotonic time in nanoseconds.
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Sleep for a number of nanoseconds, if positive.
+static void sleep_ns(int64_t ns)
+{
+    struct timespec ts;
+
+    if (ns > 0) {
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        (void)nanosleep(&ts, NULL);
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Value at a percentile of sorted samples.
+static uint64_t percentile(const uint64_t *sorted, size_t count, double pct)
+{
+    size_t rank;
+
+    if (!count) {
+        return 0;
+    }
+    rank = (size_t)(pct / 100.0 * count + 0.5);
+    return sorted[rank ? MIN(rank, count) - 1 : 0];
+}
+
+// Write one result line for a set of latency samples.  Extra is any
+// further JSON members, each followed by a comma and space.
+static void report_latency(const char *bench, const char *extra, int threads,
+                           uint64_t *samples, size_t count, uint64_t elapsed,
+                           uint64_t drops)
+{
+    qsort(samples, count, sizeof(*samples), compare_u64);
+    printf("{\"bench\": \"%s\", \"version\": \"%s\", %s\"lock\": \"%s\", "
+           "\"threads\": %d, \"ops\": %zu, \"drops\": %"PRIu64", \"ops_per_sec\": %.0f, "
+           "\"p50_ns\": %"PRIu64", \"p99_ns\": %"PRIu64", "
+           "\"p999_ns\": %"PRIu64", \"max_ns\": %"PRIu64"}\n",
+           bench, cobaro_log_version(), extra, lock_names[options.lock],
+           threads, count, drops,
+           elapsed ? count * 1e9 / elapsed : 0.0,
+           percentile(samples, count, 50), percentile(samples, count, 99),
+           percentile(samples, count, 99.9), percentile(samples, count, 100));
+    fflush(stdout);
+}
+
+
+// Consumer that returns everything it's given, until told to stop.
+struct drain {
+    cobaro_loghandle_t lh;
+    volatile bool stop;
+};
+
+static void *drain_main(void *rock)
+{
+    struct drain *drain = (struct drain *)rock;
+    cobaro_log_t log;
+
+    while (!drain->stop) {
+        if ((log = cobaro_log_next(drain->lh))) {
+            cobaro_log_return(drain->lh, log);
+        } else {
+            sched_yield();
+        }
+    }
+    while ((log = cobaro_log_next(drain->lh))) {
+        cobaro_log_return(drain->lh, log);
+    }
+    return NULL;
+}
+
+// Producer that times each successful claim, set and publish.  Failed
+// claims (the pool being empty) are counted as drops, and retried
+// after yielding, in case the consumer shares our CPU.
+struct producer {
+    cobaro_loghandle_t lh;
+    long count;
+    uint64_t *samples;
+    uint64_t drops;
+};
+
+static void *producer_main(void *rock)
+{
+    struct producer *p = (struct producer *)rock;
+    cobaro_log_t log;
+    uint64_t start;
+
+    for (long i = 0; i < p->count; ) {
+        start = now_ns();
+        log = cobaro_log_claim_code(p->lh, BENCH_MSG_MIXED, COBARO_LOG_INFO);
+        if (log) {
+            cobaro_log_set_string(log, 1, "bench");
+            cobaro_log_set_integer(log, 2, i);
+            cobaro_log_set_double(log, 3, i * 0.5);
+            cobaro_log_set_ipv4(log, 4, (uint32_t)i);
+            cobaro_log_publish(p->lh, log);
+            p->samples[i++] = now_ns() - start;
+        } else {
+            p->drops++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// Run producers against a draining consumer and report their latency.
+static int bench_producers(const char *bench, int threads)
+{
+    pthread_t drain_thread, thread[threads];
+    struct producer producer[threads];
+    struct drain drain;
+    uint64_t *samples, start, elapsed, drops = 0;
+    long per_thread = iterations / threads;
+
+    if (!(drain.lh = cobaro_log_init_with(bench_messages, &options))) {
+        return 1;
+    }
+    drain.stop = false;
+    if (!(samples = calloc(per_thread * threads, sizeof(*samples)))) {
+        cobaro_log_fini(drain.lh);
+        return 1;
+    }
+
+    pthread_create(&drain_thread, NULL, drain_main, &drain);
+    start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        producer[i].lh = drain.lh;
+        producer[i].count = per_thread;
+        producer[i].samples = &samples[i * per_thread];
+        producer[i].drops = 0;
+        pthread_create(&thread[i], NULL, producer_main, &producer[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(thread[i], NULL);
+        drops += producer[i].drops;
+    }
+    elapsed = now_ns() - start;
+    drain.stop = true;
+    pthread_join(drain_thread, NULL);
+
+    report_latency(bench, "", threads, samples, per_thread * threads,
+                   elapsed, drops);
+
+    free(samples);
+    cobaro_log_fini(drain.lh);
+    return 0;
+}
+
+// Claim, set four parameters and publish, from one thread.
+static int bench_claim_publish(void)
+{
+    return bench_producers("claim_publish", 1);
+}
+
+// As for claim_publish, from 1 to threads_max threads.
+static int bench_scaling(void)
+{
+    for (int threads = 1; threads <= threads_max; threads++) {
+        if (bench_producers("scaling", threads)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Fill in a log for formatting, using as many parameters as exist.
+static void bench_log_fill(cobaro_log_t log, int code)
+{
+    log->code = code;
+    log->level = COBARO_LOG_INFO;
+    cobaro_log_set_string(log, 1, "bench");
+    cobaro_log_set_integer(log, 2, 1234567);
+    cobaro_log_set_double(log, 3, 3.14159);
+    cobaro_log_set_ipv4(log, 4, 0x0a000001);
+    for (int i = 5; i <= COBARO_LOG_PARAM_MAX; i++) {
+        cobaro_log_set_integer(log, i, i);
+    }
+}
+
+// Format each message shape to a string.
+static int bench_to_string(void)
+{
+    cobaro_loghandle_t lh;
+    struct cobaro_log log;
+    char s[1024];
+    uint64_t start, elapsed;
+    size_t bytes;
+
+    if (!(lh = cobaro_log_init_with(bench_messages, &options))) {
+        return 1;
+    }
+
+    for (int code = 0; code < BENCH_MSG_COUNT; code++) {
+        bench_log_fill(&log, code);
+        bytes = 0;
+        start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            bytes += cobaro_log_to_string(lh, &log, s, sizeof(s));
+        }
+        elapsed = now_ns() - start;
+
+        printf("{\"bench\": \"to_string\", \"version\": \"%s\", "
+               "\"template\": \"%s\", \"ops\": %ld, \"bytes\": %zu, "
+               "\"ns_per_op\": %.1f}\n",
+               cobaro_log_version(), bench_message_names[code], iterations,
+               bytes, (double)elapsed / iterations);
+        fflush(stdout);
+    }
+
+    cobaro_log_fini(lh);
+    return 0;
+}
+
+// Format and write messages to /dev/null.
+static int bench_to_file(void)
+{
+    cobaro_loghandle_t lh;
+    struct cobaro_log log;
+    uint64_t start, elapsed, bytes = 0;
+    FILE *f;
+    int written;
+
+    if (!(f = fopen("/dev/null", "w"))) {
+        perror("/dev/null");
+        return 1;
+    }
+    if (!(lh = cobaro_log_init_with(bench_messages, &options))) {
+        fclose(f);
+        return 1;
+    }
+
+    bench_log_fill(&log, BENCH_MSG_MIXED);
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        log.p[1].v.i = i;
+        if ((written = cobaro_log_to_file(lh, &log, f)) > 0) {
+            bytes += written;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("{\"bench\": \"to_file\", \"version\": \"%s\", \"ops\": %ld, "
+           "\"bytes\": %"PRIu64", \"ops_per_sec\": %.0f, "
+           "\"mb_per_sec\": %.1f}\n",
+           cobaro_log_version(), iterations, bytes,
+           iterations * 1e9 / elapsed, bytes * 1e3 / elapsed);
+    fflush(stdout);
+
+    cobaro_log_fini(lh);
+    fclose(f);
+    return 0;
+}
+
+// Consumer that writes to a sink that can only take one message per
+// sink_delay microseconds, standing in for a slow disk.
+static void *slow_sink_main(void *rock)
+{
+    struct drain *drain = (struct drain *)rock;
+    cobaro_log_t log;
+    FILE *f;
+
+    if (!(f = fopen("/dev/null", "w"))) {
+        perror("/dev/null");
+        return NULL;
+    }
+    while (!drain->stop) {
+        if ((log = cobaro_log_next(drain->lh))) {
+            (void)cobaro_log_to_file(drain->lh, log, f);
+            sleep_ns(sink_delay * 1000);
+            cobaro_log_return(drain->lh, log);
+        } else {
+            sleep_ns(10000);
+        }
+    }
+    while ((log = cobaro_log_next(drain->lh))) {
+        cobaro_log_return(drain->lh, log);
+    }
+    fclose(f);
+    return NULL;
+}
+
+// Producer that logs at a fixed rate, timing each attempt whether it
+// succeeds or not.
+struct paced {
+    cobaro_loghandle_t lh;
+    int backpressure;
+    uint64_t end;
+    uint64_t *samples;
+    size_t samples_max;
+    size_t count;
+    uint64_t drops;
+};
+
+static void *paced_main(void *rock)
+{
+    struct paced *p = (struct paced *)rock;
+    uint64_t interval = 1000000000 / rate, next = now_ns(), start;
+    cobaro_log_t log;
+
+    while (next < p->end && p->count < p->samples_max) {
+        sleep_ns(next - now_ns());
+        next += interval;
+
+        start = now_ns();
+        for (int attempt = 0; ; attempt++) {
+            log = cobaro_log_claim_code(p->lh, BENCH_MSG_MIXED,
+                                        COBARO_LOG_INFO);
+            if (log || p->backpressure == BACKPRESSURE_DROP ||
+                (p->backpressure == BACKPRESSURE_RETRY &&
+                 attempt >= RETRY_LIMIT)) {
+                break;
+            }
+            sched_yield();
+        }
+        if (log) {
+            cobaro_log_set_string(log, 1, "bench");
+            cobaro_log_set_integer(log, 2, p->count);
+            cobaro_log_set_double(log, 3, p->count * 0.5);
+            cobaro_log_set_ipv4(log, 4, (uint32_t)p->count);
+            cobaro_log_publish(p->lh, log);
+        } else {
+            p->drops++;
+        }
+        p->samples[p->count++] = now_ns() - start;
+    }
+    return NULL;
+}
+
+// Fixed-rate producers against a slow sink, for each backpressure
+// setting.
+static int bench_slow_sink(void)
+{
+    int threads = threads_max;
+    pthread_t sink_thread, thread[threads];
+    struct paced producer[threads];
+    struct drain drain;
+    size_t per_thread = rate * seconds + 1, count;
+    uint64_t *samples, start, elapsed, drops;
+    char extra[128];
+
+    if (!(samples = calloc(per_thread * threads, sizeof(*samples)))) {
+        return 1;
+    }
+
+    for (int bp = 0; bp < BACKPRESSURE_COUNT; bp++) {
+        if (!(drain.lh = cobaro_log_init_with(bench_messages, &options))) {
+            free(samples);
+            return 1;
+        }
+        drain.stop = false;
+        pthread_create(&sink_thread, NULL, slow_sink_main, &drain);
+
+        start = now_ns();
+        for (int i = 0; i < threads; i++) {
+            producer[i].lh = drain.lh;
+            producer[i].backpressure = bp;
+            producer[i].end = start + seconds * 1000000000ull;
+            producer[i].samples = &samples[i * per_thread];
+            producer[i].samples_max = per_thread;
+            producer[i].count = 0;
+            producer[i].drops = 0;
+            pthread_create(&thread[i], NULL, paced_main, &producer[i]);
+        }
+
+        // Pack the samples together for reporting
+        count = drops = 0;
+        for (int i = 0; i < threads; i++) {
+            pthread_join(thread[i], NULL);
+            memmove(&samples[count], producer[i].samples,
+                    producer[i].count * sizeof(*samples));
+            count += producer[i].count;
+            drops += producer[i].drops;
+        }
+        elapsed = now_ns() - start;
+        drain.stop = true;
+        pthread_join(sink_thread, NULL);
+
+        snprintf(extra, sizeof(extra), "\"backpressure\": \"%s\", "
+                 "\"rate\": %ld, \"sink_delay_us\": %ld, ",
+                 backpressure_names[bp], rate, sink_delay);
+        report_latency("slow_sink", extra, threads, samples, count,
+                       elapsed, drops);
+
+        cobaro_log_fini(drain.lh);
+    }
+
+    free(samples);
+    return 0;
+}
+
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} benches[] = {
+    { "claim_publish", bench_claim_publish },
+    { "to_string", bench_to_string },
+    { "to_file", bench_to_file },
+    { "scaling", bench_scaling },
+    { "slow_sink", bench_slow_sink },
+};
+
+#define BENCHES_COUNT ((int)(sizeof(benches) / sizeof(benches[0])))
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-t max threads] "
+            "[-r rate] [-d sink delay us] [-s seconds] [-l lock] "
+            "[bench ...]\n"
+            "locks:", argv0);
+    for (int i = 0; i < COBARO_LOG_LOCKS_COUNT; i++) {
+        fprintf(stderr, " %s", lock_names[i]);
+    }
+    fprintf(stderr, "\nbenches:");
+    for (int i = 0; i < BENCHES_COUNT; i++) {
+        fprintf(stderr, " %s", benches[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    int opt, failed = 0;
+
+    cobaro_log_options_init(&options);
+    while ((opt = getopt(argc, argv, "n:t:r:d:s:l:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = MAX(atol(optarg), 1);
+            break;
+        case 't':
+            threads_max = MAX(atoi(optarg), 1);
+            break;
+        case 'r':
+            rate = MAX(atol(optarg), 1);
+            break;
+        case 'd':
+            sink_delay = MAX(atol(optarg), 0);
+            break;
+        case 's':
+            seconds = MAX(atol(optarg), 1);
+            break;
+        case 'l':
+            for (options.lock = 0; options.lock < COBARO_LOG_LOCKS_COUNT;
+                 options.lock++) {
+                if (!strcmp(optarg, lock_names[options.lock])) {
+                    break;
+                }
+            }
+            if (options.lock == COBARO_LOG_LOCKS_COUNT) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Run everything, or just those named.
+    for (int i = 0; i < BENCHES_COUNT; i++) {
+        bool run = optind == argc;
+
+        for (int arg = optind; arg < argc; arg++) {
+            run |= !strcmp(argv[arg], benches[i].name);
+        }
+        if (run) {
+            fprintf(stderr, "Running %s\n", benches[i].name);
+            failed |= benches[i].run();
+        }
+    }
+
+    return failed;
+}
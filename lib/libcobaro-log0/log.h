@@ -19,6 +19,10 @@ COPYRIGHT_END
 #include <string.h>
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /// @file
 /// @mainpage Light-weight, internationalized, inter-thread log messages.
 /// 
@@ -53,7 +57,16 @@ enum cobaro_log_types {
     COBARO_STRING = 1,  ///< Value is a string.
     COBARO_INTEGER = 2,  ///< Value is a signed integer.
     COBARO_REAL = 3,  ///< Value is a double.
-    COBARO_IPV4 = 4  ///< Value is an IP address (in 32 bit network format).
+    COBARO_IPV4 = 4,  ///< Value is an IP address (in 32 bit network format).
+    COBARO_UINT64 = 5,  ///< Value is an unsigned integer.
+    COBARO_HEX = 6,  ///< Value is an unsigned integer, shown in hex.
+    COBARO_BOOL = 7,  ///< Value is a boolean, shown as true or false.
+    COBARO_IPV6 = 8,  ///< Value is an IPv6 address (128 bit network format).
+    COBARO_POINTER = 9,  ///< Value is a pointer, shown as an address.
+    COBARO_DURATION_NS = 10,  ///< Value is a signed interval in nanoseconds.
+    COBARO_TIMESTAMP = 11,  ///< Value is UTC nanoseconds since the epoch.
+    COBARO_STATIC_STRING = 12,  ///< Value is a reference to a lasting string.
+    COBARO_LONG_STRING = 13  ///< Value is a reference into the handle's arena.
 };
 
 
@@ -71,8 +84,48 @@ enum cobaro_log_levels {
 };
 
 
-/// Number of parameters in a log message structure.
-#define COBARO_LOG_PARAM_MAX (8) // Search log.c for PARAM_MAX_FIX if changed
+/// Size in bytes of a log message structure.
+///
+/// One of three profiles: 512 (the default) carries 8 parameters with
+/// strings of up to 47 characters, 256 carries 4 with strings of up to
+/// 47, and 128 carries 3 with strings of up to 23.  Smaller records
+/// fit more messages per cache line and page.  The 256 and 128
+/// profiles are filled exactly; the 512 one keeps 32 bytes of padding,
+/// as a longer string would push each parameter past a multiple of 8
+/// bytes.
+///
+/// This must match the value the library was built with, which is
+/// set by configure's @c --with-record-size option, given by
+/// @c pkg-config @c --cflags, and returned by cobaro_log_record_size().
+#ifndef COBARO_LOG_RECORD_SIZE
+#  define COBARO_LOG_RECORD_SIZE 512
+#endif
+
+#if COBARO_LOG_RECORD_SIZE == 512
+#  define COBARO_LOG_PARAM_MAX (8)
+#  define COBARO_LOG_STRING_MAX (48)
+#elif COBARO_LOG_RECORD_SIZE == 256
+#  define COBARO_LOG_PARAM_MAX (4)
+#  define COBARO_LOG_STRING_MAX (48)
+#elif COBARO_LOG_RECORD_SIZE == 128
+#  define COBARO_LOG_PARAM_MAX (3)
+#  define COBARO_LOG_STRING_MAX (24)
+#else
+#  error COBARO_LOG_RECORD_SIZE must be 512, 256 or 128
+#endif
+
+/// @def COBARO_LOG_PARAM_MAX
+/// Number of parameters in a log message structure.  At most 9, as
+/// templates refer to parameters by a single digit.
+
+/// @def COBARO_LOG_STRING_MAX
+/// Bytes for a string parameter, including its terminating null.
+
+// Header bytes before the padding, and the padding needed to make the
+// whole record COBARO_LOG_RECORD_SIZE bytes.
+#define COBARO_LOG_HEADER_SIZE (32)
+#define COBARO_LOG_PAD_SIZE (COBARO_LOG_RECORD_SIZE - COBARO_LOG_HEADER_SIZE - \
+                             COBARO_LOG_PARAM_MAX * (8 + COBARO_LOG_STRING_MAX))
 
 
 /// Log information structure.
@@ -95,10 +148,28 @@ struct cobaro_log {
     /// Log level, from @ref cobaro_log_levels enumeration.
     uint8_t level;
 
-    // 3 spare bytes here.
+    /// Pool this log belongs to, for returning it.  Set by
+    /// cobaro_log_init(); do not modify.
+    uint8_t pool;
+
+    /// Bytes of this log's long string region in use.  Reset by
+    /// cobaro_log_claim(); do not modify.
+    uint16_t arena_used;
 
-    /// Pad to make us fit into 512 bytes exactly.
-    char pad[44];
+    /// Sampling rate.  If more than one, this message was kept by
+    /// sampling (see cobaro_log_sample_set()) and stands for this many
+    /// occurrences.  Set by cobaro_log_claim_code(), and only noted
+    /// for logs claimed from the handle.
+    uint32_t sample;
+
+    /// Monotonic time of publication in nanoseconds, if latency is
+    /// being measured (see cobaro_log_latency_enable()), else zero.
+    uint64_t published;
+
+#if COBARO_LOG_PAD_SIZE > 0
+    /// Pad to make us fit into @ref COBARO_LOG_RECORD_SIZE bytes exactly.
+    char pad[COBARO_LOG_PAD_SIZE];
+#endif
 
     /// Array of parameters relevant to this log.
     struct {
@@ -111,7 +182,7 @@ struct cobaro_log {
         /// Value
         union {
             /// String value.
-            char s[48];
+            char s[COBARO_LOG_STRING_MAX];
             
             /// Integer value.
             int64_t i;
@@ -121,6 +192,23 @@ struct cobaro_log {
 
             /// IPv4 address (32 bit network format)
             uint32_t ipv4;
+
+            /// Unsigned integer value, also used for hex, boolean,
+            /// pointer and timestamp values.
+            uint64_t u;
+
+            /// IPv6 address (128 bit network format)
+            uint8_t ipv6[16];
+
+            /// Reference to a string that outlives the log, or to a
+            /// long string in the handle's arena.
+            struct {
+                /// First character, not necessarily null terminated.
+                const char *s;
+
+                /// Length in bytes.
+                uint64_t len;
+            } ss;
         } v;
     } p[COBARO_LOG_PARAM_MAX];
 
@@ -138,35 +226,337 @@ typedef struct cobaro_log *cobaro_log_t;
 typedef struct cobaro_loghandle *cobaro_loghandle_t;
 
 
+/// Producer-side filter table.
+///
+/// Holds, for each message code in the catalog, the most verbose
+/// level that will be claimed for that code, or -1 if the code is
+/// disabled.  The handle level and the per-code enable flag are
+/// folded into this one byte, which follows the count in the same
+/// block, so the check loads the table pointer from the handle and
+/// then that byte.
+///
+/// The table is never resized in place: a handle's first member is a
+/// pointer to its current table, which is replaced as a whole when a
+/// larger catalog is installed.  Use cobaro_log_enabled() rather than
+/// reading it directly.
+struct cobaro_log_filter {
+    /// Number of message codes covered by @c threshold.
+    uint32_t count;
+
+    /// Per-code maximum level, or -1 if the code is disabled.
+    int8_t threshold[];
+};
+
+
+/// Locks available to protect a handle's queues.
+///
+/// Both spin, pausing between reads while the lock is held, and never
+/// yield the CPU, as the lock is only ever held briefly.
+enum cobaro_log_locks {
+    /// Test-and-test-and-set.  Cheapest, but unfair: under heavy
+    /// contention one producer may repeatedly beat the others.
+    COBARO_LOG_LOCK_TTAS = 0,
+
+    /// Ticket lock.  Waiters take the lock in arrival order, so no
+    /// producer is starved, at some cost in throughput.
+    COBARO_LOG_LOCK_TICKET,
+
+    COBARO_LOG_LOCKS_COUNT  ///< Iterator useful.
+};
+
+/// Pool allocation flags, for cobaro_log_options::pool.
+///
+/// Each is applied where the platform supports it, and otherwise
+/// silently dropped: see cobaro_log_pool_flags().
+enum cobaro_log_pool_flags {
+    /// Back the pool with 2MB huge pages, to save TLB misses.
+    COBARO_LOG_POOL_HUGEPAGES = 1,
+
+    /// Lock the pool into memory, so it's never paged out.
+    COBARO_LOG_POOL_MLOCK = 2,
+
+    /// Split the pool between NUMA nodes, with each node's share
+    /// placed in its memory.  Claims prefer the caller's node.
+    COBARO_LOG_POOL_NUMA = 4,
+
+    /// Give each CPU a pool and queue of its own, which producers use
+    /// without locks, so claiming and publishing write only to the
+    /// caller's CPU's cache lines.  Each CPU gets the full number of
+    /// slots, and this replaces @ref COBARO_LOG_POOL_NUMA.  Messages
+    /// published on different CPUs may be reported out of order, as
+    /// may those from one CPU once its queue fills and later messages
+    /// overflow to the shared queue, which is reported first.
+    COBARO_LOG_POOL_PER_CPU = 8
+};
+
+/// Binary message catalog, mapped from a file.
+struct cobaro_log_catalog;
+
+/// Handle options, for cobaro_log_init_with().
+///
+/// Always initialize with cobaro_log_options_init() before setting
+/// members, so that defaults are set for any added in later releases.
+struct cobaro_log_options {
+    /// Size of this structure, as known to the caller.  Set by
+    /// cobaro_log_options_init().
+    size_t size;
+
+    /// Queue lock, from @ref cobaro_log_locks enumeration.  Default is
+    /// @ref COBARO_LOG_LOCK_TTAS.
+    int lock;
+
+    /// Number of logs in the pool, which bounds how many can be
+    /// claimed but not yet returned.  Default is 16.  With
+    /// @ref COBARO_LOG_POOL_PER_CPU, the number for each CPU.
+    uint32_t slots;
+
+    /// Pool allocation, a bitwise or of @ref cobaro_log_pool_flags.
+    /// Default is zero.
+    int pool;
+
+    /// Bytes of string arena per log, for cobaro_log_set_long_string(),
+    /// at most 65535.  Default is zero, for no arena.
+    uint32_t arena;
+
+    /// Binary catalog to use instead of the @p messages passed to
+    /// cobaro_log_init_with(), see cobaro_log_catalog_open().  Must
+    /// stay open while the handle uses it.  Default is @c NULL.
+    const struct cobaro_log_catalog *catalog;
+};
+
+/// Description of a message code.
+///
+/// Catalogs generated by cobaro-log-catalog include a table of these,
+/// indexed by code and ended by an entry with a @c NULL name.
+struct cobaro_log_message_info {
+    /// Name of the code, without its enumeration's prefix.
+    const char *name;
+
+    /// Level the code is logged at, from @ref cobaro_log_levels.
+    int level;
+
+    /// Number of parameters.
+    int count;
+
+    /// Type of each parameter, from @ref cobaro_log_types.  At most
+    /// nine, as templates refer to parameters by a single digit.
+    uint8_t types[9];
+};
+
+/// Binary catalog file, see cobaro_log_catalog_open().
+///
+/// A header, then an entry per code, then the templates, each ended by
+/// a NUL.  Fields are in the byte order of the host that reads them;
+/// a file in the other order fails the version check.
+///
+/// Written by cobaro-log-catalog --binary.
+#define COBARO_LOG_CATALOG_MAGIC "cblogcat"
+
+/// Version of the binary catalog format.
+#define COBARO_LOG_CATALOG_VERSION (1)
+
+/// Binary catalog file header.
+struct cobaro_log_catalog_header {
+    /// @ref COBARO_LOG_CATALOG_MAGIC, without its NUL.
+    char magic[8];
+
+    /// @ref COBARO_LOG_CATALOG_VERSION.
+    uint32_t version;
+
+    /// Number of codes, which is the number of entries.
+    uint32_t count;
+
+    /// Size of the file in bytes.
+    uint32_t size;
+
+    /// Zero.
+    uint32_t reserved;
+};
+
+/// Binary catalog entry, describing one code's template.
+struct cobaro_log_catalog_entry {
+    /// From the start of the file.
+    uint32_t offset;
+
+    /// Of the template, without its NUL.
+    uint32_t length;
+
+    /// Bitmap of the parameters the template refers to, bit n for %n+1.
+    uint32_t used;
+};
+
+
 
 /// Printable version number.
 char *cobaro_log_version(void);
 
+/// Version of the layouts that inline functions in this header depend
+/// on: struct cobaro_log, and the filter pointer at the start of the
+/// handle.  Incremented whenever either changes incompatibly.
+#define COBARO_LOG_ABI_VERSION (1)
+
+/// ABI version the library was built with.
+///
+/// Programs should check that this is @ref COBARO_LOG_ABI_VERSION
+/// before initializing, as the inline functions they were compiled
+/// with may not match the library otherwise.
+///
+/// @returns
+///    The library's @ref COBARO_LOG_ABI_VERSION.
+int cobaro_log_abi_version(void);
+
+/// Size of the log message structure the library was built with.
+///
+/// Programs should check that this is @c sizeof(struct cobaro_log)
+/// before initializing, in case they were compiled with a different
+/// @ref COBARO_LOG_RECORD_SIZE.
+///
+/// @returns
+///    Size in bytes.
+size_t cobaro_log_record_size(void);
+
 /// Initialize  the logging infrastructure.
 ///
 /// Must be called once before logging.  By default logging is to
 /// stdout at level LOG_INFO.
 ///
 /// @param[in] messages
-///    Array of message format strings. See test/messages.[ch] for
-///    examples.
+///    Array of message format strings, terminated by an empty string
+///    (or @c NULL) entry. See test/messages.def for an example.
 ///
 /// @returns
 ///    Valid log handle on success, @c NULL on failure.
 cobaro_loghandle_t cobaro_log_init(char **messages);
 
+/// Set handle options to their defaults.
+///
+/// @param[out] options
+///    Options to initialize.
+void cobaro_log_options_init(struct cobaro_log_options *options);
+
+/// Initialize the logging infrastructure, with options.
+///
+/// As for cobaro_log_init(), which is equivalent to passing @c NULL
+/// options.
+///
+/// @param[in] messages
+///    Array of message format strings, terminated by an empty string
+///    (or @c NULL) entry.
+///
+/// @param[in] options
+///    Options, initialized by cobaro_log_options_init(), or @c NULL
+///    for defaults.
+///
+/// @returns
+///    Valid log handle on success, @c NULL on failure, including if
+///    an option is out of range.
+cobaro_loghandle_t cobaro_log_init_with(char **messages,
+                                        const struct cobaro_log_options *options);
+
 /// Set the message catalog in use (in case you want to change language).
 ///
+/// If the new catalog has more messages than the old one, the extra
+/// codes are enabled.
+///
+/// Safe to call at any time, including while other threads log and
+/// report: each message is formatted entirely with either the old
+/// catalog or the new one.  The old catalog may still be in use when
+/// this returns; call cobaro_log_synchronize() before freeing it.
+/// If memory can't be allocated, the catalog is left unchanged.
+///
 /// @param[in] lh
 ///    Log handle to set messages catalog for.
 ///
 /// @param[in] messages
-///    Array of message format strings. See test/messages.[ch] for
-///    examples.
+///    Array of message format strings, terminated by an empty string
+///    (or @c NULL) entry. See test/messages.def for an example.
+void cobaro_log_messages_set(cobaro_loghandle_t lh, char **messages);
+
+/// Open a binary message catalog.
+///
+/// The file is mapped read-only, so loading takes the same time
+/// whatever its size, and processes using the same file share its
+/// pages.  Only the header is checked here; each lookup checks the
+/// code against the count, and its entry against the file's bounds.
+///
+/// @param[in] path
+///    Catalog file, as written by cobaro-log-catalog --binary.
 ///
 /// @returns
-///    Valid log handle on success, @c NULL on failure.
-void cobaro_log_messages_set(cobaro_loghandle_t lh, char **messages);
+///    Catalog, or @c NULL with @c errno set if the file can't be read
+///    (@c EINVAL if it isn't a valid catalog).
+struct cobaro_log_catalog *cobaro_log_catalog_open(const char *path);
+
+/// Close a binary message catalog.
+///
+/// No handle may use the catalog afterward: replace it, and call
+/// cobaro_log_synchronize(), or finalise the handle, first.
+///
+/// @param[in] catalog
+///    Catalog to close.  May be @c NULL.
+void cobaro_log_catalog_close(struct cobaro_log_catalog *catalog);
+
+/// Number of codes in a binary message catalog.
+///
+/// @param[in] catalog
+///    Open catalog.
+///
+/// @returns
+///    Number of codes.
+uint32_t cobaro_log_catalog_count(const struct cobaro_log_catalog *catalog);
+
+/// Template for a code in a binary message catalog.
+///
+/// @param[in] catalog
+///    Open catalog.
+///
+/// @param[in] code
+///    Log code.
+///
+/// @returns
+///    Template, in %n form, or @c NULL if @p code is outside the
+///    catalog.
+const char *cobaro_log_catalog_template(
+    const struct cobaro_log_catalog *catalog, uint32_t code);
+
+/// Set a binary message catalog as the one in use.
+///
+/// As cobaro_log_messages_set(), which replaces it in turn.  The
+/// catalog must stay open while the handle uses it.
+///
+/// @param[in] lh
+///    Log handle to set catalog for.
+///
+/// @param[in] catalog
+///    Open catalog.
+///
+/// @returns
+///    @c true on success, @c false if memory can't be allocated.
+bool cobaro_log_catalog_set(cobaro_loghandle_t lh,
+                            const struct cobaro_log_catalog *catalog);
+
+/// Wait until no reporting call is using a replaced configuration.
+///
+/// Once this returns, a catalog replaced by cobaro_log_messages_set()
+/// or cobaro_log_catalog_set(), or a file replaced by
+/// cobaro_log_file_set(), is no longer in use by the handle and may
+/// be freed or closed.  Waits only for reporting calls in other
+/// threads that started before it was called, and lets other threads
+/// change the configuration meanwhile.
+///
+/// @param[in] lh
+///    Log handle in use.
+void cobaro_log_synchronize(cobaro_loghandle_t lh);
+
+/// Report which pool allocation flags are in effect.
+///
+/// @param[in] lh
+///    Log handle to query.
+///
+/// @returns
+///    Those @ref cobaro_log_pool_flags requested at initialization
+///    that the platform honoured.
+int cobaro_log_pool_flags(cobaro_loghandle_t lh);
 
 /// Finalize the logging infrastructure.
 ///
@@ -191,6 +581,216 @@ void cobaro_log_fini(cobaro_loghandle_t lh);
 ///    continue its work without logging.
 cobaro_log_t cobaro_log_claim(cobaro_loghandle_t lh);
 
+/// Test whether a log message would be accepted by the handle.
+///
+/// This is the producer-side filter: it checks both the handle's log
+/// level and the per-code enable flag set via
+/// cobaro_log_code_enable(), and is cheap enough to call before doing
+/// any work to gather parameters.
+///
+/// @param[in] lh
+///    Log handle to test against.
+///
+/// @param[in] code
+///    Log code, as will be set in cobaro_log::code.
+///
+/// @param[in] level
+///    Log level, from @ref cobaro_log_levels enumeration.
+///
+/// @returns
+///    @c true if a message with this code and level should be
+///    logged, @c false if it would be discarded.
+static inline bool cobaro_log_enabled(cobaro_loghandle_t lh,
+                                      uint32_t code, int level)
+{
+    const struct cobaro_log_filter *filter =
+        *(struct cobaro_log_filter * const *)lh;
+
+    return code < filter->count && level <= filter->threshold[code];
+}
+
+/// Acquire a log structure, if its code and level are enabled.
+///
+/// Performs the cobaro_log_enabled() test before claiming, so that a
+/// filtered message costs no more than that test.  On success the
+/// returned log has its @c code and @c level already set.
+///
+/// @param[in] lh
+///    Log handle to fetch from.
+///
+/// @param[in] code
+///    Log code for the message.
+///
+/// @param[in] level
+///    Log level for the message.
+///
+/// @returns
+///    Pointer to log structure on success.  @c NULL if the message is
+///    filtered, or if no log structures are available (see
+///    cobaro_log_claim()).
+cobaro_log_t cobaro_log_claim_code(cobaro_loghandle_t lh,
+                                   uint32_t code, int level);
+
+/// Most verbose level compiled into COBARO_LOG_IF() call sites.
+///
+/// Define this before including log.h (or on the compiler command
+/// line) to remove more verbose call sites from the build entirely,
+/// eg. @c -DCOBARO_LOG_COMPILE_LEVEL=COBARO_LOG_INFO for release
+/// builds without debug logging.
+#ifndef COBARO_LOG_COMPILE_LEVEL
+#  define COBARO_LOG_COMPILE_LEVEL COBARO_LOG_DEBUG
+#endif
+
+/// Branch hint that a condition is rarely true.
+#if defined(__GNUC__)
+#  define COBARO_LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#  define COBARO_LOG_UNLIKELY(x) (x)
+#endif
+
+/// Whether call sites at @p level are compiled in.
+///
+/// A constant expression when @p level is, so code guarded by it
+/// is removed at compile time when false.
+#define COBARO_LOG_COMPILED(level) ((level) <= COBARO_LOG_COMPILE_LEVEL)
+
+/// Claim, populate and publish a log message in one statement.
+///
+/// Runs the following block with @p log bound to a claimed log
+/// structure, whose code and level are set, and publishes it
+/// afterwards.  The block is skipped if the message is filtered (see
+/// cobaro_log_claim_code()) or no structure is available.  If @p level
+/// is more verbose than @ref COBARO_LOG_COMPILE_LEVEL, the whole
+/// statement is compiled out.  Otherwise the test is hinted as
+/// unlikely, so the compiler moves the block out of the hot path.
+///
+/// @code
+/// COBARO_LOG_IF(lh, COBARO_LOG_DEBUG, MY_LOG_SOSO, log) {
+///     cobaro_log_set_string(log, 1, "sample");
+///     cobaro_log_set_integer(log, 2, count);
+/// }
+/// @endcode
+///
+/// Don't @c break, @c return or @c goto out of the block, as the log
+/// structure would not be published.
+#define COBARO_LOG_IF(lh, level, code, log)                             \
+    for (cobaro_log_t log =                                             \
+             COBARO_LOG_COMPILED(level) &&                              \
+             COBARO_LOG_UNLIKELY(cobaro_log_enabled((lh), (code), (level))) \
+             ? cobaro_log_claim_code((lh), (code), (level)) : NULL;     \
+         log;                                                           \
+         cobaro_log_publish((lh), log), log = NULL)
+
+/// Enable or disable a single message code.
+///
+/// All codes are enabled when a catalog is installed.  Disabled codes
+/// are rejected by cobaro_log_enabled() and cobaro_log_claim_code()
+/// regardless of level.  May be called at any time, including while
+/// other threads are logging.
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] code
+///    Log code to change.
+///
+/// @param[in] enable
+///    @c true to enable, @c false to disable.
+///
+/// @returns
+///    @c true on success, @c false if @p code is outside the catalog.
+bool cobaro_log_code_enable(cobaro_loghandle_t lh, uint32_t code, bool enable);
+
+/// Sampling modes for cobaro_log_sample_set().
+enum cobaro_log_sample_modes {
+    COBARO_LOG_SAMPLE_NONE = 0,  ///< Keep every message.
+    COBARO_LOG_SAMPLE_RATIO,  ///< Keep each message with probability 1/n.
+    COBARO_LOG_SAMPLE_EVERY,  ///< Keep every nth message.
+    COBARO_LOG_SAMPLE_FIRST  ///< Keep the first n messages each second.
+};
+
+/// Keep only a sample of the messages for a code.
+///
+/// Applies to cobaro_log_claim_code(), which makes the decision
+/// before claiming, using a per-thread random number generator for
+/// @ref COBARO_LOG_SAMPLE_RATIO.  Messages that are kept carry in
+/// cobaro_log::sample the number of occurrences they stand for, so
+/// counts can be extrapolated; cobaro_log_to_file() and
+/// cobaro_log_to_syslog() note it after the message text.
+///
+/// Sampling is applied before any rate limit (see
+/// cobaro_log_rate_limit_set()).  The same concurrency rules apply.
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] code
+///    Log code to sample.
+///
+/// @param[in] mode
+///    How to sample, from @ref cobaro_log_sample_modes.
+///
+/// @param[in] n
+///    Sampling parameter, as described for @p mode.  Must be at least
+///    one unless @p mode is @ref COBARO_LOG_SAMPLE_NONE.
+///
+/// @returns
+///    @c true on success, @c false if @p code, @p mode or @p n is out
+///    of range, or memory could not be allocated.
+bool cobaro_log_sample_set(cobaro_loghandle_t lh, uint32_t code,
+                           int mode, uint32_t n);
+
+/// Limit the rate at which a message code may be claimed.
+///
+/// Applies a token bucket to cobaro_log_claim_code(): each message
+/// takes a token, tokens are replenished at @p rate per second, and
+/// up to @p burst may be held.  Messages for which no token is
+/// available are refused before claiming, and counted.  The counts
+/// are reported as a warning via the handle's default destination by
+/// cobaro_log(), at most every ten seconds, or on demand by
+/// cobaro_log_rate_limit_report().
+///
+/// A limit may be set for all levels of a code, and separately for
+/// each level; a message must satisfy both.
+///
+/// Safe to call from any thread, including while other threads log
+/// or change the handle's configuration.
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] code
+///    Log code to limit.
+///
+/// @param[in] level
+///    Level to limit, or -1 to limit the code at all levels.
+///
+/// @param[in] rate
+///    Messages allowed per second, on average.  Zero removes the
+///    limit.  Rates below one a year are treated as one a year.
+///
+/// @param[in] burst
+///    Messages allowed back-to-back before the rate applies.  Zero is
+///    treated as one.
+///
+/// @returns
+///    @c true on success, @c false if @p code or @p level is out of
+///    range, @p rate is negative or not finite, or memory could not be
+///    allocated.
+bool cobaro_log_rate_limit_set(cobaro_loghandle_t lh, uint32_t code,
+                               int level, double rate, uint32_t burst);
+
+/// Report messages suppressed by rate limiting.
+///
+/// Writes one warning per rate-limited code (and level) that has
+/// refused messages since the last report, via the handle's default
+/// destination.  cobaro_log() does this periodically, but a reporting
+/// thread that may go idle should call it as well.
+///
+/// @param[in] lh
+///    Log handle in use.
+void cobaro_log_rate_limit_report(cobaro_loghandle_t lh);
+
 /// Helper function for setting a string parameter.
 ///
 /// Ensures that the string is copied and terminated properly in a
@@ -200,19 +800,86 @@ cobaro_log_t cobaro_log_claim(cobaro_loghandle_t lh);
 ///    Log structure to populate.
 ///
 /// @param[in] argnum
-///    Argument number (as in, %n, being array index + 1).
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
 ///
 /// @param[in] source
-///    C-string to copy to log structure's parameters.
+///    C-string to copy to log structure's parameters, truncated to
+///    fit @ref COBARO_LOG_STRING_MAX bytes.
 void cobaro_log_set_string(cobaro_log_t log, int argnum, const char *source);
 
+/// Helper function for setting a string parameter longer than a
+/// parameter can hold.
+///
+/// Each log claimed from a handle with an arena (see
+/// cobaro_log_options::arena) has a region of it to itself.  The
+/// string is copied into the unused part of that region, and the
+/// parameter refers to it there.  The region is reclaimed when the log
+/// is next claimed, so no locking or allocation is needed.
+///
+/// Messages with long string parameters are never coalesced (see
+/// cobaro_log_coalesce_set()).
+///
+/// @param[in] lh
+///    Log handle the log was claimed from.
+///
+/// @param[in] log
+///    Log structure to populate.  If it wasn't claimed from @p lh, or
+///    @p lh has no arena, the string is copied as by
+///    cobaro_log_set_string().
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    C-string to copy.
+///
+/// @returns
+///    @c true if the whole string was stored, @c false if it was
+///    truncated to fit.
+bool cobaro_log_set_long_string(cobaro_loghandle_t lh, cobaro_log_t log,
+                                int argnum, const char *source);
+
+/// Helper function for setting a string parameter without copying it.
+///
+/// Only a pointer and length are stored, and the reporter reads the
+/// string itself, so it must stay unchanged until the log has been
+/// reported and returned: a string literal, or one interned for the
+/// life of the handle.  Use cobaro_log_set_string() for anything
+/// else.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    String to refer to.
+///
+/// @param[in] length
+///    Length of the string in bytes, excluding any terminating null.
+void cobaro_log_set_static_string(cobaro_log_t log, int argnum,
+                                  const char *source, size_t length);
+
+/// Set a string literal parameter without copying it.
+///
+/// As cobaro_log_set_static_string(), with the length worked out at
+/// compile time.  Only accepts a string literal.
+#define cobaro_log_set_literal(log, argnum, literal) \
+    cobaro_log_set_static_string((log), (argnum), "" literal, \
+                                 sizeof(literal) - 1)
+
 /// Helper function for setting an integer parameter.
 ///
 /// @param[in] log
 ///    Log structure to populate.
 ///
 /// @param[in] argnum
-///    Argument number (as in, %n, being array index + 1).
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
 ///
 /// @param[in] source
 ///    Integer value to set.
@@ -224,7 +891,8 @@ void cobaro_log_set_integer(cobaro_log_t log, int argnum, int64_t source);
 ///    Log structure to populate.
 ///
 /// @param[in] argnum
-///    Argument number (as in, %n, being array index + 1).
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
 ///
 /// @param[in] source
 ///    Double/real value to set.
@@ -236,12 +904,355 @@ void cobaro_log_set_double(cobaro_log_t log, int argnum, double source);
 ///    Log structure to populate.
 ///
 /// @param[in] argnum
-///    Argument number (as in, %n, being array index + 1).
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
 ///
 /// @param[in] source
 ///    IPv4 address, in **host** byte order.
 void cobaro_log_set_ipv4(cobaro_log_t log, int argnum, uint32_t source);
 
+/// Helper function for setting an unsigned integer parameter.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    Unsigned integer value to set.
+void cobaro_log_set_uint64(cobaro_log_t log, int argnum, uint64_t source);
+
+/// Helper function for setting an integer parameter shown in hex.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    Value to set, shown as @c 0x followed by lower case hex digits.
+void cobaro_log_set_hex(cobaro_log_t log, int argnum, uint64_t source);
+
+/// Helper function for setting a boolean parameter.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    Value to set, shown as @c true or @c false.
+void cobaro_log_set_bool(cobaro_log_t log, int argnum, bool source);
+
+/// Helper function for setting an IPv6 parameter.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    16 byte IPv6 address, in network byte order (as in
+///    @c struct @c in6_addr).
+void cobaro_log_set_ipv6(cobaro_log_t log, int argnum, const uint8_t *source);
+
+/// Helper function for setting a pointer parameter.
+///
+/// Only the address is kept, so the pointer need not remain valid.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    Pointer to set.
+void cobaro_log_set_pointer(cobaro_log_t log, int argnum, const void *source);
+
+/// Helper function for setting a duration parameter.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    Duration in nanoseconds, shown in the largest of ns, us, ms or s
+///    that leaves a whole part, e.g. @c 1.5ms.
+void cobaro_log_set_duration_ns(cobaro_log_t log, int argnum, int64_t source);
+
+/// Helper function for setting a timestamp parameter.
+///
+/// @param[in] log
+///    Log structure to populate.
+///
+/// @param[in] argnum
+///    Argument number (as in, %n, being array index + 1).  Ignored if
+///    more than @ref COBARO_LOG_PARAM_MAX.
+///
+/// @param[in] source
+///    Nanoseconds since the Unix epoch, shown as ISO 8601 UTC, e.g.
+///    @c 2015-06-01T12:00:00.000000000Z.
+void cobaro_log_set_timestamp(cobaro_log_t log, int argnum, uint64_t source);
+
+// Inline versions of the setters above, which the setters' names map
+// to unless COBARO_LOG_NO_INLINE is defined, so that setting a
+// parameter needs no call into the library.  The out of line
+// functions remain, for taking their address and for other languages.
+// These depend on the layout of struct cobaro_log, which is covered
+// by COBARO_LOG_ABI_VERSION.
+
+static inline void cobaro_log_set_string_inline(
+    cobaro_log_t log, int argnum, const char *source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_STRING;
+    strncpy(log->p[index].v.s, source, sizeof(log->p[index].v.s));
+    log->p[index].v.s[sizeof(log->p[index].v.s) - 1] = '\0';
+}
+
+static inline void cobaro_log_set_static_string_inline(
+    cobaro_log_t log, int argnum, const char *source,
+    size_t length)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_STATIC_STRING;
+    log->p[index].v.ss.s = source;
+    log->p[index].v.ss.len = length;
+}
+
+static inline void cobaro_log_set_integer_inline(
+    cobaro_log_t log, int argnum, int64_t source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_INTEGER;
+    log->p[index].v.i = source;
+}
+
+static inline void cobaro_log_set_double_inline(
+    cobaro_log_t log, int argnum, double source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_REAL;
+    log->p[index].v.f = source;
+}
+
+static inline void cobaro_log_set_ipv4_inline(
+    cobaro_log_t log, int argnum, uint32_t source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_IPV4;
+    log->p[index].v.ipv4 = source;
+}
+
+static inline void cobaro_log_set_uint64_inline(
+    cobaro_log_t log, int argnum, uint64_t source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_UINT64;
+    log->p[index].v.u = source;
+}
+
+static inline void cobaro_log_set_hex_inline(
+    cobaro_log_t log, int argnum, uint64_t source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_HEX;
+    log->p[index].v.u = source;
+}
+
+static inline void cobaro_log_set_bool_inline(
+    cobaro_log_t log, int argnum, bool source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_BOOL;
+    log->p[index].v.u = source ? 1 : 0; // all 8 bytes, for coalescing
+}
+
+static inline void cobaro_log_set_ipv6_inline(
+    cobaro_log_t log, int argnum, const uint8_t *source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_IPV6;
+    memcpy(log->p[index].v.ipv6, source, sizeof(log->p[index].v.ipv6));
+}
+
+static inline void cobaro_log_set_pointer_inline(
+    cobaro_log_t log, int argnum, const void *source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_POINTER;
+    log->p[index].v.u = (uintptr_t)source; // all 8 bytes, even if 32 bit
+}
+
+static inline void cobaro_log_set_duration_ns_inline(
+    cobaro_log_t log, int argnum, int64_t source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_DURATION_NS;
+    log->p[index].v.i = source;
+}
+
+static inline void cobaro_log_set_timestamp_inline(
+    cobaro_log_t log, int argnum, uint64_t source)
+{
+    int index = argnum - 1; // %n is 1-based
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return;
+    }
+    log->p[index].type = COBARO_TIMESTAMP;
+    log->p[index].v.u = source;
+}
+
+#if !defined(COBARO_LOG_NO_INLINE)
+#  define cobaro_log_set_string(log, argnum, source)                    \
+    cobaro_log_set_string_inline((log), (argnum), (source))
+#  define cobaro_log_set_static_string(log, argnum, source, length)     \
+    cobaro_log_set_static_string_inline((log), (argnum), (source), (length))
+#  define cobaro_log_set_integer(log, argnum, source)                   \
+    cobaro_log_set_integer_inline((log), (argnum), (source))
+#  define cobaro_log_set_double(log, argnum, source)                    \
+    cobaro_log_set_double_inline((log), (argnum), (source))
+#  define cobaro_log_set_ipv4(log, argnum, source)                      \
+    cobaro_log_set_ipv4_inline((log), (argnum), (source))
+#  define cobaro_log_set_uint64(log, argnum, source)                    \
+    cobaro_log_set_uint64_inline((log), (argnum), (source))
+#  define cobaro_log_set_hex(log, argnum, source)                       \
+    cobaro_log_set_hex_inline((log), (argnum), (source))
+#  define cobaro_log_set_bool(log, argnum, source)                      \
+    cobaro_log_set_bool_inline((log), (argnum), (source))
+#  define cobaro_log_set_ipv6(log, argnum, source)                      \
+    cobaro_log_set_ipv6_inline((log), (argnum), (source))
+#  define cobaro_log_set_pointer(log, argnum, source)                   \
+    cobaro_log_set_pointer_inline((log), (argnum), (source))
+#  define cobaro_log_set_duration_ns(log, argnum, source)               \
+    cobaro_log_set_duration_ns_inline((log), (argnum), (source))
+#  define cobaro_log_set_timestamp(log, argnum, source)                 \
+    cobaro_log_set_timestamp_inline((log), (argnum), (source))
+#endif
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+
+// Store one parameter, choosing its type from the value's.
+#define COBARO_LOG_PUT_(log, argnum, value)                             \
+    _Generic((value),                                                   \
+        char *: cobaro_log_set_string_inline,                           \
+        const char *: cobaro_log_set_string_inline,                     \
+        bool: cobaro_log_set_bool_inline,                               \
+        char: cobaro_log_set_integer_inline,                            \
+        signed char: cobaro_log_set_integer_inline,                     \
+        short: cobaro_log_set_integer_inline,                           \
+        int: cobaro_log_set_integer_inline,                             \
+        long: cobaro_log_set_integer_inline,                            \
+        long long: cobaro_log_set_integer_inline,                       \
+        unsigned char: cobaro_log_set_uint64_inline,                    \
+        unsigned short: cobaro_log_set_uint64_inline,                   \
+        unsigned int: cobaro_log_set_uint64_inline,                     \
+        unsigned long: cobaro_log_set_uint64_inline,                    \
+        unsigned long long: cobaro_log_set_uint64_inline,               \
+        float: cobaro_log_set_double_inline,                            \
+        double: cobaro_log_set_double_inline,                           \
+        long double: cobaro_log_set_double_inline,                      \
+        default: cobaro_log_set_pointer_inline)((log), (argnum), (value));
+
+// Argument counting, for up to a code and eight parameters.
+#define COBARO_LOG_FIRST_(first, ...) first
+#define COBARO_LOG_COUNT_(...)                                          \
+    COBARO_LOG_COUNT_N_(__VA_ARGS__, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define COBARO_LOG_COUNT_N_(_1, _2, _3, _4, _5, _6, _7, _8, _9, n, ...) n
+#define COBARO_LOG_CAT_(a, b) a ## b
+#define COBARO_LOG_PUTS_(n) COBARO_LOG_CAT_(COBARO_LOG_PUTS_, n)
+
+// Store each parameter after the code.
+#define COBARO_LOG_PUTS_1(log, code)
+#define COBARO_LOG_PUTS_2(log, code, a)                                 \
+    COBARO_LOG_PUT_(log, 1, a)
+#define COBARO_LOG_PUTS_3(log, code, a, b)                              \
+    COBARO_LOG_PUTS_2(log, code, a) COBARO_LOG_PUT_(log, 2, b)
+#define COBARO_LOG_PUTS_4(log, code, a, b, c)                           \
+    COBARO_LOG_PUTS_3(log, code, a, b) COBARO_LOG_PUT_(log, 3, c)
+#define COBARO_LOG_PUTS_5(log, code, a, b, c, d)                        \
+    COBARO_LOG_PUTS_4(log, code, a, b, c) COBARO_LOG_PUT_(log, 4, d)
+#define COBARO_LOG_PUTS_6(log, code, a, b, c, d, e)                     \
+    COBARO_LOG_PUTS_5(log, code, a, b, c, d) COBARO_LOG_PUT_(log, 5, e)
+#define COBARO_LOG_PUTS_7(log, code, a, b, c, d, e, f)                  \
+    COBARO_LOG_PUTS_6(log, code, a, b, c, d, e) COBARO_LOG_PUT_(log, 6, f)
+#define COBARO_LOG_PUTS_8(log, code, a, b, c, d, e, f, g)               \
+    COBARO_LOG_PUTS_7(log, code, a, b, c, d, e, f) COBARO_LOG_PUT_(log, 7, g)
+#define COBARO_LOG_PUTS_9(log, code, a, b, c, d, e, f, g, h)            \
+    COBARO_LOG_PUTS_8(log, code, a, b, c, d, e, f, g) COBARO_LOG_PUT_(log, 8, h)
+
+/// Log a message in one statement (C11 and later).
+///
+/// Takes the message code, then up to @ref COBARO_LOG_PARAM_MAX
+/// parameters, whose types are chosen from the arguments' types:
+/// strings are copied, signed and unsigned integers, @c bool and
+/// floating point values are stored as such, and other pointers are
+/// stored as addresses.  The stores are inline, and the message is
+/// filtered, claimed and published as by COBARO_LOG_IF().  Use
+/// COBARO_LOG_IF() with the setters for other parameter types, such
+/// as IPv4 addresses.  Note that the constants @c true and @c false
+/// are integers, so only @c bool variables are stored as booleans.
+///
+/// @code
+/// COBARO_LOG(lh, COBARO_LOG_INFO, MY_LOG_CONNECTED, hostname, port);
+/// @endcode
+#define COBARO_LOG(lh, level, ...)                                      \
+    do {                                                                \
+        COBARO_LOG_IF((lh), (level), COBARO_LOG_FIRST_(__VA_ARGS__, ~), \
+                      cobaro_log_m_) {                                  \
+            COBARO_LOG_PUTS_(COBARO_LOG_COUNT_(__VA_ARGS__))(           \
+                cobaro_log_m_, __VA_ARGS__)                             \
+        }                                                               \
+    } while (0)
+
+#endif // C11
+
 /// Publish a log_t relinqushing its memory.
 ///
 /// @param[in] lh
@@ -267,7 +1278,8 @@ cobaro_log_t cobaro_log_next(cobaro_loghandle_t lh);
 ///    Log handle to receive a log from.
 ///
 /// @param[in] log
-///    Pointer to log structure to be returned to free list.
+///    Pointer to log structure to be returned to free list.  A log
+///    that wasn't claimed from @p lh is ignored.
 void cobaro_log_return(cobaro_loghandle_t lh, cobaro_log_t log);
 
 /// Emit a log to the loghandle's default destination.
@@ -286,6 +1298,41 @@ void cobaro_log_return(cobaro_loghandle_t lh, cobaro_log_t log);
 ///    @c true on success, @c false on any failure.
 bool cobaro_log(cobaro_loghandle_t lh, cobaro_log_t log);
 
+/// Coalesce repeated messages reported by cobaro_log().
+///
+/// When enabled, a message that would format identically to the one
+/// before it (same code, level and referenced parameters) and that
+/// arrives within @p window_ms of it is not reported.  Instead, once a
+/// different message arrives, or a repeat arrives after the window
+/// has passed, a single "last message repeated N times" line is
+/// written.  Duplicates are detected by hashing the log structure, not
+/// by formatting it.
+///
+/// Coalescing is off by default.  Only cobaro_log() is affected; the
+/// cobaro_log_to_*() functions report every message.
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] window_ms
+///    Milliseconds after a message during which its repeats are
+///    coalesced.  Zero disables coalescing.
+///
+/// @returns
+///    @c true on success, @c false on failure.
+bool cobaro_log_coalesce_set(cobaro_loghandle_t lh, unsigned int window_ms);
+
+/// Write any summaries the handle is holding.
+///
+/// Reports pending repeat counts (see cobaro_log_coalesce_set()) and
+/// rate limit counts (see cobaro_log_rate_limit_report()) via the
+/// default destination.  Call this when the reporting thread goes
+/// idle, and before cobaro_log_fini().
+///
+/// @param[in] lh
+///    Log handle in use.
+void cobaro_log_flush(cobaro_loghandle_t lh);
+
 /// Log a message to syslog.
 ///
 /// This call assumes your application has established and configured
@@ -337,7 +1384,8 @@ int cobaro_log_to_file(cobaro_loghandle_t lh, cobaro_log_t log, FILE *f);
 /// 
 /// The function will not write more than @p buflen bytes and will
 /// always NUL-terminate the string even if that means truncating the
-/// formatted message.
+/// formatted message.  A code with no template in the catalog, eg.
+/// from a corrupt record, is formatted as "unknown code N".
 ///
 /// @param[in] lh
 ///    Log handle in use.
@@ -360,8 +1408,58 @@ int cobaro_log_to_file(cobaro_loghandle_t lh, cobaro_log_t log, FILE *f);
 int cobaro_log_to_string(cobaro_loghandle_t lh, cobaro_log_t log,
 			 char *buffer, size_t buflen);
 
+/// Description of a code's template, worked out when its catalog is set.
+struct cobaro_log_code_info {
+    /// Number of parameters: the highest the template refers to.
+    uint32_t params;
+
+    /// Bitmap of the parameters the template refers to, bit n for %n+1.
+    uint32_t used;
+
+    /// Most bytes cobaro_log_to_string() can need for the code,
+    /// including the NUL, unless it has static or long string
+    /// parameters longer than @ref COBARO_LOG_STRING_MAX.
+    size_t length_max;
+};
+
+/// Describe a code's template in the handle's catalog.
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] code
+///    Log code.
+///
+/// @param[out] info
+///    Description, set on success.
+///
+/// @returns
+///    @c true on success, @c false if the code has no template.
+bool cobaro_log_code_info(cobaro_loghandle_t lh, uint32_t code,
+                          struct cobaro_log_code_info *info);
+
+/// Most bytes cobaro_log_to_string() can need for a message.
+///
+/// Taken from the description of its code, plus the lengths of any
+/// static or long strings, so a buffer of this size is always enough
+/// and needn't be retried.
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] log
+///    Log data.
+///
+/// @returns
+///    Bytes, including the NUL.
+size_t cobaro_log_string_size(cobaro_loghandle_t lh, cobaro_log_t log);
+
 /// Set the log level below which we should ignore logs.
 ///
+/// The level applies both to producers, via cobaro_log_enabled() and
+/// cobaro_log_claim_code(), and to reporting.  Safe to call at any
+/// time, including while other threads log and report.
+///
 /// @param[in] lh
 ///     Log handle in use.
 ///
@@ -373,8 +1471,103 @@ int cobaro_log_to_string(cobaro_loghandle_t lh, cobaro_log_t log,
 ///    @c true on success, @c false on failure.
 bool cobaro_log_loglevel_set(cobaro_loghandle_t lh, int level);
 
+/// Counters describing a log handle's activity since it was created.
+struct cobaro_log_stats {
+    uint64_t claims;  ///< Log structures claimed.
+    uint64_t claim_failures;  ///< Claims that found no free structure.
+    uint64_t publishes;  ///< Logs published to the handle's queue.
+    uint64_t queue_depth;  ///< Logs waiting in the queue now.
+    uint64_t queue_depth_max;  ///< Most logs ever waiting in the queue.
+
+    /// Messages written by the file and syslog reporters, by level.
+    uint64_t emitted[COBARO_LOG_LEVELS_COUNT];
+
+    /// Messages discarded by level or code, when claiming or
+    /// reporting, by level.
+    uint64_t filtered[COBARO_LOG_LEVELS_COUNT];
+
+    uint64_t sampled_out;  ///< Messages not kept by sampling.
+    uint64_t rate_limited;  ///< Messages refused by rate limits.
+    uint64_t coalesced;  ///< Repeats coalesced by cobaro_log().
+    uint64_t bytes_written;  ///< Bytes of messages written.
+    uint64_t sink_errors;  ///< Messages that failed to be written.
+};
+
+/// Fetch a log handle's statistics.
+///
+/// Counters are kept per thread, so that keeping them adds no
+/// contention between threads, and summed by this function.  It may
+/// be called from any thread at any time; counters being updated
+/// concurrently may or may not be included.
+///
+/// @param[in] lh
+///     Log handle in use.
+///
+/// @param[out] stats
+///     Filled in with the handle's counters.
+void cobaro_log_stats(cobaro_loghandle_t lh, struct cobaro_log_stats *stats);
+
+/// Latencies measured by cobaro_log_latency_enable().
+enum cobaro_log_latencies {
+    COBARO_LOG_LATENCY_QUEUE = 0,  ///< From publish to cobaro_log_next().
+    COBARO_LOG_LATENCY_WRITE,  ///< From cobaro_log_next() to written.
+    COBARO_LOG_LATENCIES_COUNT  ///< Iterator useful.
+};
+
+/// Measure how long messages take to be reported.
+///
+/// When enabled, cobaro_log_publish() stamps each message, and the
+/// handle records into histograms the time from publication until
+/// cobaro_log_next() returns it, and from then until
+/// cobaro_log_to_file() or cobaro_log_to_syslog() has written it.
+/// Histograms are log-linear, with a precision of 1/16th of each
+/// power of two.
+///
+/// Measurement assumes a single reporting thread per handle.  It is
+/// off by default, and costs a clock read per publish and two per
+/// report.
+///
+/// @param[in] lh
+///     Log handle in use.
+///
+/// @param[in] enable
+///     @c true to start measuring, @c false to stop.
+///
+/// @returns
+///    @c true on success, @c false if memory could not be allocated.
+bool cobaro_log_latency_enable(cobaro_loghandle_t lh, bool enable);
+
+/// Fetch a percentile of a measured latency.
+///
+/// @param[in] lh
+///     Log handle in use.
+///
+/// @param[in] latency
+///     Which latency, from @ref cobaro_log_latencies.
+///
+/// @param[in] percentile
+///     Percentile to fetch, from 0 to 100, eg. 99.9.
+///
+/// @returns
+///     The latency in nanoseconds that @p percentile of measurements
+///     were no more than (to within the histogram's precision), or
+///     zero if nothing has been measured.
+uint64_t cobaro_log_latency_percentile(cobaro_loghandle_t lh, int latency,
+                                       double percentile);
+
+/// Discard latency measurements so far.
+///
+/// @param[in] lh
+///     Log handle in use.
+void cobaro_log_latency_reset(cobaro_loghandle_t lh);
+
 /// Set the default log destination to be a file handle.
 ///
+/// Replaces any destinations added by cobaro_log_file_add() or
+/// cobaro_log_syslog_add().  Safe to call while other threads log and
+/// report; the previous file may be written to until
+/// cobaro_log_synchronize() returns.
+///
 /// @param[in] lh
 ///     Log handle in use.
 ///
@@ -387,8 +1580,12 @@ bool cobaro_log_file_set(cobaro_loghandle_t lh, FILE *f);
 
 /// Set the default log destination to be syslog.
 ///
+/// Replaces any destinations added by cobaro_log_file_add() or
+/// cobaro_log_syslog_add().
+///
 /// Caller is responsible for calling openlog(ident, option, facility)
-/// and closelog(), see syslog(3).
+/// and closelog(), see syslog(3).  Safe to call while other threads
+/// log and report.
 ///
 /// @param[in] lh
 ///     Log handle in use.
@@ -397,6 +1594,52 @@ bool cobaro_log_file_set(cobaro_loghandle_t lh, FILE *f);
 ///    @c true on success, @c false on failure.
 bool cobaro_log_syslog_set(cobaro_loghandle_t lh);
 
+/// Most destinations a handle can write to at once.
+#define COBARO_LOG_SINKS_MAX (4)
+
+/// Add a file handle to the destinations, with its own catalog.
+///
+/// Each message is written to every destination, in its catalog's
+/// language.  A message is formatted once for each catalog in use, so
+/// destinations sharing a catalog share the formatting.
+/// cobaro_log_file_set() and cobaro_log_syslog_set() replace all the
+/// destinations with one.  Safe to call while other threads log and
+/// report.
+///
+/// @param[in] lh
+///     Log handle in use.
+///
+/// @param[in] f
+///     File handle to log to.
+///
+/// @param[in] messages
+///     Catalog for this destination, with the same codes as the
+///     handle's, or @c NULL to use the handle's, even if it's changed
+///     by cobaro_log_messages_set().
+///
+/// @returns
+///    @c true on success, @c false if there are already
+///    @ref COBARO_LOG_SINKS_MAX destinations, or memory can't be
+///    allocated.
+bool cobaro_log_file_add(cobaro_loghandle_t lh, FILE *f, char **messages);
+
+/// Add syslog to the destinations, with its own catalog.
+///
+/// As cobaro_log_file_add().
+///
+/// @param[in] lh
+///     Log handle in use.
+///
+/// @param[in] messages
+///     Catalog for this destination, or @c NULL to use the handle's.
+///
+/// @returns
+///    @c true on success, @c false on failure.
+bool cobaro_log_syslog_add(cobaro_loghandle_t lh, char **messages);
+
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* COBARO_LOG0_LOG_H */
@@ -0,0 +1,430 @@
+// -*- mode: c++ -*-
+#ifndef COBARO_LOG0_LOG_HPP
+#define COBARO_LOG0_LOG_HPP
+
+/****************************************************************
+COPYRIGHT_BEGIN
+Copyright (C) 2015, cobaro.org
+All rights reserved.
+COPYRIGHT_END
+****************************************************************/
+
+// All available in C++11
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "libcobaro-log0/log.h"
+
+/// @file
+/// Type-checked C++ interface.
+///
+/// Each message code is declared with the types of its parameters, by
+/// specializing cobaro::message:
+///
+/// @code
+/// namespace cobaro {
+/// template <> struct message<MY_LOG_CONNECTED>
+///     : signature<const char *, std::uint16_t> {};
+/// }
+/// @endcode
+///
+/// Catalogs built with cobaro::make_catalog() are checked against
+/// these declarations at compile time, and cobaro::log() checks its
+/// arguments against them, so a template that refers to a parameter
+/// the code doesn't have, or a call that passes the wrong type, fails
+/// to compile.
+///
+/// Everything here is inline: cobaro::log() makes the same calls and
+/// stores as COBARO_LOG_IF() with the C setters.
+
+namespace cobaro {
+
+/// An IPv4 address parameter.
+struct ipv4 {
+    /// @param[in] network_order
+    ///    Address, in network byte order, as in @c struct @c in_addr.
+    constexpr explicit ipv4(std::uint32_t network_order)
+        : address(network_order) {}
+
+    std::uint32_t address;  ///< Address, in network byte order.
+};
+
+/// An unsigned integer parameter, shown in hex.
+struct hex {
+    /// @param[in] v
+    ///    Value to show.
+    constexpr explicit hex(std::uint64_t v) : value(v) {}
+
+    std::uint64_t value;  ///< Value to show.
+};
+
+/// An IPv6 address parameter.
+struct ipv6 {
+    /// @param[in] network_order
+    ///    16 bytes of address, in network byte order, as for
+    ///    cobaro_log_set_ipv6().
+    constexpr explicit ipv6(const std::uint8_t *network_order)
+        : address(network_order) {}
+
+    const std::uint8_t *address;  ///< First of 16 bytes.
+};
+
+/// A string parameter that is referred to rather than copied.
+///
+/// Converts implicitly from a string literal.  As for
+/// cobaro_log_set_static_string(), the string must stay unchanged
+/// until the log has been reported, so don't pass a character array
+/// that will be reused.
+struct static_string {
+    /// @param[in] literal
+    ///    String literal.
+    template <std::size_t N>
+    constexpr static_string(const char (&literal)[N])
+        : s(literal), length(N - 1) {}
+
+    /// @param[in] source
+    ///    String to refer to.
+    ///
+    /// @param[in] len
+    ///    Length in bytes, excluding any terminating null.
+    constexpr static_string(const char *source, std::size_t len)
+        : s(source), length(len) {}
+
+    const char *s;  ///< First character.
+    std::size_t length;  ///< Length in bytes.
+};
+
+
+/// How a value of type @p T is stored in a log parameter.
+///
+/// Specialized for @c const @c char @c * (copied, as by
+/// cobaro_log_set_string()), @c bool, signed and unsigned integers,
+/// floating point, @c const @c void @c *, @c std::chrono durations and
+/// system clock time points, and the types above.  Others are
+/// incomplete, so can't be used in a signature.
+template <typename T, typename Enable = void>
+struct param;
+
+/// @cond internal
+
+template <>
+struct param<const char *> {
+    static void set(cobaro_log_t log, int argnum, const char *v) {
+        cobaro_log_set_string_inline(log, argnum, v);
+    }
+};
+
+template <>
+struct param<static_string> {
+    static void set(cobaro_log_t log, int argnum, const static_string &v) {
+        cobaro_log_set_static_string_inline(log, argnum, v.s, v.length);
+    }
+};
+
+template <>
+struct param<bool> {
+    static void set(cobaro_log_t log, int argnum, bool v) {
+        cobaro_log_set_bool_inline(log, argnum, v);
+    }
+};
+
+template <typename T>
+struct param<T, typename std::enable_if<std::is_integral<T>::value &&
+                                        std::is_signed<T>::value>::type> {
+    static void set(cobaro_log_t log, int argnum, T v) {
+        cobaro_log_set_integer_inline(log, argnum, v);
+    }
+};
+
+template <typename T>
+struct param<T, typename std::enable_if<std::is_integral<T>::value &&
+                                        std::is_unsigned<T>::value &&
+                                        !std::is_same<T, bool>::value>::type> {
+    static void set(cobaro_log_t log, int argnum, T v) {
+        cobaro_log_set_uint64_inline(log, argnum, v);
+    }
+};
+
+template <typename T>
+struct param<T, typename std::enable_if<
+                    std::is_floating_point<T>::value>::type> {
+    static void set(cobaro_log_t log, int argnum, T v) {
+        cobaro_log_set_double_inline(log, argnum, v);
+    }
+};
+
+template <>
+struct param<const void *> {
+    static void set(cobaro_log_t log, int argnum, const void *v) {
+        cobaro_log_set_pointer_inline(log, argnum, v);
+    }
+};
+
+template <typename Rep, typename Period>
+struct param<std::chrono::duration<Rep, Period> > {
+    static void set(cobaro_log_t log, int argnum,
+                    const std::chrono::duration<Rep, Period> &v) {
+        cobaro_log_set_duration_ns_inline(
+            log, argnum,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(v).count());
+    }
+};
+
+// The system clock's epoch is the Unix epoch on every platform we
+// support, though C++ only promises that from C++20.
+template <typename Duration>
+struct param<std::chrono::time_point<std::chrono::system_clock, Duration> > {
+    static void set(cobaro_log_t log, int argnum,
+                    const std::chrono::time_point<std::chrono::system_clock,
+                                                  Duration> &v) {
+        cobaro_log_set_timestamp_inline(
+            log, argnum,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                v.time_since_epoch()).count());
+    }
+};
+
+template <>
+struct param<ipv4> {
+    static void set(cobaro_log_t log, int argnum, const ipv4 &v) {
+        cobaro_log_set_ipv4_inline(log, argnum, v.address);
+    }
+};
+
+template <>
+struct param<hex> {
+    static void set(cobaro_log_t log, int argnum, const hex &v) {
+        cobaro_log_set_hex_inline(log, argnum, v.value);
+    }
+};
+
+template <>
+struct param<ipv6> {
+    static void set(cobaro_log_t log, int argnum, const ipv6 &v) {
+        cobaro_log_set_ipv6_inline(log, argnum, v.address);
+    }
+};
+
+namespace detail {
+
+// Whether a value may be passed for a parameter of a type: it must
+// convert implicitly, and not from floating point to integer or from
+// a pointer to bool, which C++ allows but are never what was meant.
+template <typename Type, typename Value>
+struct accepts {
+    typedef typename std::decay<Value>::type value_type;
+
+    static constexpr bool value =
+        std::is_convertible<Value, Type>::value &&
+        !(std::is_floating_point<value_type>::value &&
+          std::is_integral<Type>::value) &&
+        !(std::is_pointer<value_type>::value &&
+          std::is_same<Type, bool>::value);
+};
+
+// Sets parameters argnum onwards from values, converting each to its
+// declared type.
+template <int argnum, typename... Types>
+struct setter;
+
+template <int argnum>
+struct setter<argnum> {
+    static void apply(cobaro_log_t) {}
+};
+
+template <int argnum, typename Type, typename... Types>
+struct setter<argnum, Type, Types...> {
+    template <typename Value, typename... Values>
+    static void apply(cobaro_log_t log, Value &&value, Values &&... values) {
+        static_assert(accepts<Type, Value &&>::value,
+                      "argument does not match the message's signature");
+        param<Type>::set(log, argnum, std::forward<Value>(value));
+        setter<argnum + 1, Types...>::apply(log,
+                                            std::forward<Values>(values)...);
+    }
+};
+
+// Bitmap of the parameters a message template refers to, read as the
+// reporter does.  Throws, which fails compilation in a constant
+// expression, for a stray % or a parameter that no log can carry.
+constexpr std::uint32_t params_used(const char *format,
+                                    std::uint32_t used = 0)
+{
+    return *format == '\0' ? used
+        : *format != '%' ? params_used(format + 1, used)
+        : format[1] == '%' ? params_used(format + 2, used)
+        : format[1] > '0' && format[1] <= '0' + COBARO_LOG_PARAM_MAX
+        ? params_used(format + 2, used | 1u << (format[1] - '1'))
+        : throw std::logic_error("stray % or parameter out of range "
+                                 "in message template");
+}
+
+// Codes 0 to N-1, for building catalogs.
+template <std::uint32_t... codes>
+struct code_list {};
+
+template <std::uint32_t N, std::uint32_t... codes>
+struct make_code_list : make_code_list<N - 1, N - 1, codes...> {};
+
+template <std::uint32_t... codes>
+struct make_code_list<0, codes...> {
+    typedef code_list<codes...> type;
+};
+
+} // namespace detail
+
+/// @endcond
+
+/// Parameter types of a message.
+///
+/// Derive cobaro::message specializations from this.  At most
+/// @ref COBARO_LOG_PARAM_MAX types, each one that cobaro::param
+/// supports.
+template <typename... Types>
+struct signature {
+    static_assert(sizeof...(Types) <= COBARO_LOG_PARAM_MAX,
+                  "more parameters than a log can carry");
+
+    /// Number of parameters.
+    static constexpr std::size_t count = sizeof...(Types);
+
+    /// Bitmap of the parameters, which each template for this message
+    /// must refer to exactly.
+    static constexpr std::uint32_t used = (1u << sizeof...(Types)) - 1;
+
+    /// Set the parameters of a log, checking each value against its
+    /// type.
+    ///
+    /// @param[in] log
+    ///    Log structure to populate.
+    ///
+    /// @param[in] values
+    ///    One value per parameter, each implicitly convertible to its
+    ///    type, other than floating point to integer or pointer to
+    ///    bool.
+    template <typename... Values>
+    static void set(cobaro_log_t log, Values &&... values) {
+        static_assert(sizeof...(Values) == sizeof...(Types),
+                      "wrong number of arguments for the message");
+        detail::setter<1, Types...>::apply(log,
+                                           std::forward<Values>(values)...);
+    }
+};
+
+/// Declaration of message code @p code.
+///
+/// Specialize this for each code, deriving from cobaro::signature.
+/// Codes without a declaration can't be used with cobaro::log() or
+/// cobaro::make_catalog().
+template <std::uint32_t code>
+struct message;
+
+
+/// Message catalog, checked against the message declarations.
+///
+/// Make these with cobaro::make_catalog(), as @c constexpr variables
+/// so that the checks are made at compile time.
+template <std::size_t N>
+class catalog {
+public:
+    /// @cond internal
+    template <std::uint32_t... codes, typename... Formats>
+    constexpr catalog(detail::code_list<codes...>, Formats... formats)
+        : formats_{check<codes>(formats)..., ""} {}
+    /// @endcond
+
+    /// Catalog in the form cobaro_log_init() and
+    /// cobaro_log_messages_set() take.  The library doesn't modify it.
+    char **messages() const {
+        return const_cast<char **>(formats_);
+    }
+
+    /// Number of messages.
+    static constexpr std::size_t size() {
+        return N;
+    }
+
+private:
+    template <std::uint32_t code>
+    static constexpr const char *check(const char *format) {
+        return detail::params_used(format) == message<code>::used
+            ? format
+            : throw std::logic_error("message template does not use "
+                                     "exactly the parameters declared");
+    }
+
+    const char *formats_[N + 1];
+};
+
+/// Make a message catalog.
+///
+/// @code
+/// constexpr auto my_messages_en = cobaro::make_catalog(
+///     "connected to %1 port %2",  // MY_LOG_CONNECTED
+///     "disconnected");            // MY_LOG_DISCONNECTED
+/// @endcode
+///
+/// Fails to compile, when the result is @c constexpr, if any template
+/// refers to a parameter its code's signature doesn't declare, or
+/// doesn't refer to one it does, or has a stray @c %.
+///
+/// @param[in] formats
+///    Templates for codes zero onwards, in order.
+///
+/// @returns
+///    Catalog of the templates.
+template <typename... Formats>
+constexpr catalog<sizeof...(Formats)> make_catalog(Formats... formats)
+{
+    return catalog<sizeof...(Formats)>(
+        typename detail::make_code_list<sizeof...(Formats)>::type(),
+        formats...);
+}
+
+/// Claim, populate and publish a log message.
+///
+/// As COBARO_LOG_IF(), with each parameter set from an argument of
+/// the type declared for @p code.  Arguments are evaluated even if the
+/// message is filtered, so test cobaro_log_enabled() first if they
+/// are costly to compute.
+///
+/// @code
+/// cobaro::log<MY_LOG_CONNECTED>(lh, COBARO_LOG_INFO, host, port);
+/// @endcode
+///
+/// @param[in] lh
+///    Log handle in use.
+///
+/// @param[in] level
+///    Log level, from @ref cobaro_log_levels enumeration.
+///
+/// @param[in] values
+///    One value per parameter, as for cobaro::signature::set().
+///
+/// @returns
+///    @c true if the message was published, @c false if it was
+///    filtered or no log structure was available.
+template <std::uint32_t code, typename... Values>
+inline bool log(cobaro_loghandle_t lh, int level, Values &&... values)
+{
+    if (!(COBARO_LOG_COMPILED(level) &&
+          COBARO_LOG_UNLIKELY(cobaro_log_enabled(lh, code, level)))) {
+        return false;
+    }
+
+    cobaro_log_t log = cobaro_log_claim_code(lh, code, level);
+    if (!log) {
+        return false;
+    }
+    message<code>::set(log, std::forward<Values>(values)...);
+    cobaro_log_publish(lh, log);
+    return true;
+}
+
+} // namespace cobaro
+
+#endif // COBARO_LOG0_LOG_HPP
@@ -7,15 +7,30 @@ COPYRIGHT_END
 ****************************************************************/
 
 // Defining _XOPENS_SOURCE to 700 means:
-//   we get __USE_OPEN2K defined for pthread_spinlock*
 //   we get _POSIX_C_SOURCE defined sufficiently to get nanosleep/timespec
+// Defining _DEFAULT_SOURCE as well means:
+//   we get MAP_ANONYMOUS, MAP_HUGETLB and syscall()
+// Defining _GNU_SOURCE as well means:
+//   we get sched_getcpu()
 #ifndef _XOPEN_SOURCE
 # define _XOPEN_SOURCE 700
 #endif
+#ifndef _DEFAULT_SOURCE
+# define _DEFAULT_SOURCE
+#endif
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
 
 #include "config.h"
+
+// Declare the setters as functions, so they are defined out of line
+// here, for callers that can't use the inline versions.
+#define COBARO_LOG_NO_INLINE
 #include "libcobaro-log0/log.h"
 
+#include <stddef.h>
+
 #if defined(HAVE_ARPA_INET_H)
 # include <arpa/inet.h>
 #endif
@@ -24,6 +39,14 @@ COPYRIGHT_END
 # include <errno.h>
 #endif
 
+#if defined(HAVE_FCNTL_H)
+# include <fcntl.h>
+#endif
+
+#if defined(HAVE_MATH_H)
+# include <math.h>
+#endif
+
 #if defined(HAVE_PTHREAD_H)
 # include <pthread.h>
 #endif
@@ -44,12 +67,76 @@ COPYRIGHT_END
 #  include <sys/param.h>
 #endif
 
-#if !defined(HAVE_PTHREAD_SPINLOCKS)
-#  include "spin.h"
+#if defined(HAVE_SCHED_H)
+#  include <sched.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H)
+#  include <sys/mman.h>
+#endif
+
+#if defined(HAVE_RSEQ)
+#  include <sys/rseq.h>
+#endif
+
+#if defined(HAVE_SYS_STAT_H)
+#  include <sys/stat.h>
+#endif
+
+#if defined(HAVE_SYS_SYSCALL_H)
+#  include <sys/syscall.h>
 #endif
 
+#if defined(HAVE_UNISTD_H)
+#  include <unistd.h>
+#endif
+
+// Pools are mapped if we can, so that they're page aligned for mlock
+// and mbind and come zeroed without being touched.
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+#  define COBARO_LOG_MMAP
+#endif
+
+// NUMA placement uses the system calls directly, to avoid a
+// dependency on libnuma.
+#if defined(COBARO_LOG_MMAP) && defined(SYS_getcpu) && defined(SYS_mbind)
+#  define COBARO_LOG_NUMA
+#  define COBARO_LOG_MPOL_PREFERRED (1) // from <numaif.h>
+#endif
+
+#include "spin.h"
+
 #define COBARO_LOG_SLOTS (16) // Keep it small as we have limited cache
 #define COBARO_LOG_FORMAT_MAX (1024) // Max size we allow for format strings
+#define COBARO_LOG_NS (1000000000ull) // Nanoseconds per second
+// Most bytes a parameter formats to, unless it's a static or long
+// string: a full string or an IPv6 address, whichever is longer.
+#define COBARO_LOG_PARAM_WIDTH_MAX \
+    MAX(COBARO_LOG_STRING_MAX - 1, INET6_ADDRSTRLEN - 1)
+// Rendered in place of a code with no template.
+#define COBARO_LOG_UNKNOWN "unknown code %"PRIu32
+#define COBARO_LOG_UNKNOWN_MAX (sizeof("unknown code 4294967295"))
+#define COBARO_LOG_RATE_REPORT_NS (10 * COBARO_LOG_NS) // Summary interval
+// Limits on a rate limit's token interval and burst, well short of
+// where adding them to the clock could wrap.
+#define COBARO_LOG_RATE_INTERVAL_MAX (366 * 86400 * COBARO_LOG_NS) // A year
+#define COBARO_LOG_RATE_TOLERANCE_MAX (UINT64_MAX / 4)
+#define COBARO_LOG_CACHELINE (64) // Bytes, or a multiple thereof
+#define COBARO_LOG_HIST_SUB_BITS (4) // Histogram buckets per power of two
+#define COBARO_LOG_HIST_SUB (1 << COBARO_LOG_HIST_SUB_BITS)
+#define COBARO_LOG_HIST_BUCKETS ((64 - COBARO_LOG_HIST_SUB_BITS + 1) * COBARO_LOG_HIST_SUB)
+#define COBARO_LOG_HUGEPAGE (2 * 1024 * 1024) // Bytes
+#define COBARO_LOG_NODES_MAX (8) // NUMA nodes given pools of their own
+#define COBARO_LOG_NODE_IDS (1024) // Node ids we can bind to, as the kernel
+#define COBARO_LOG_CPUS_MAX (256) // CPUs given pools of their own, see log->pool
+#define COBARO_LOG_NODE_REFRESH (256) // Claims between checks of our node
+#define COBARO_LOG_THREAD_CACHE (4) // Handles a thread finds its state for fast
+
+#if defined(HAVE_THREAD_LOCAL)
+#  define COBARO_LOG_TLS __thread
+#else
+#  define COBARO_LOG_TLS // Shared, which is only unfortunate
+#endif
 
 
 // Define a portable format for suseconds_t (from struct timeval).
@@ -68,62 +155,1090 @@ enum cobaro_logto_t {
     COBARO_LOGTO_SYSLOG
 };
 
-struct cobaro_loghandle {
+// A token bucket, kept as a GCRA theoretical arrival time so that a
+// producer can take a token with a single compare-and-swap.
+struct cobaro_log_bucket {
+    uint64_t interval;   // ns between tokens, zero if unlimited
+    uint64_t tolerance;  // ns of burst allowed ahead of schedule
+    uint64_t tat;        // theoretical arrival time of next message
+    uint32_t suppressed; // messages refused since last report
+};
+
+// A sampling rule.
+struct cobaro_log_sample {
+    int mode;            // from cobaro_log_sample_modes
+    uint32_t n;          // as per mode
+    uint64_t limit;      // RATIO: keep if random number is below this
+    uint64_t count;      // EVERY: messages seen
+    uint64_t second;     // FIRST: second being counted
+    uint32_t kept;       // FIRST: messages kept this second
+    uint32_t skipped;    // FIRST: messages dropped since one was kept
+};
+
+// Per-code producer policy, allocated only for codes that have one.
+// The final bucket applies to all levels.
+struct cobaro_log_policy {
+    struct cobaro_log_sample sample;
+    struct cobaro_log_bucket bucket[COBARO_LOG_LEVELS_COUNT + 1];
+};
+
+// Count into the calling thread's state.  Only it writes there, so a
+// plain store does, unless it's sharing the handle's stray state.
+#define COBARO_LOG_COUNT(lh, counter, n) \
+    do { \
+        struct cobaro_log_thread *counting = cobaro_log_thread(lh); \
+        if (counting == &(lh)->stray) { \
+            (void) __sync_fetch_and_add(&counting->s.counter, (n)); \
+        } else { \
+            *(volatile uint64_t *)&counting->s.counter += (n); \
+        } \
+    } while (0)
+
+// Clamp a level for use as an index.
+#define COBARO_LOG_LEVEL_INDEX(level) \
+    ((level) < 0 ? 0 : MIN((level), COBARO_LOG_DEBUG))
+
+// Log-linear latency histogram: values below COBARO_LOG_HIST_SUB have
+// a bucket each, and each power of two above that is split into
+// COBARO_LOG_HIST_SUB buckets.
+struct cobaro_log_histogram {
+    uint64_t count;
+    uint64_t bucket[COBARO_LOG_HIST_BUCKETS];
+};
+
+// A pool of logs, and the lock for its free list.  There's one per
+// NUMA node if pools are split, else just the one.
+struct cobaro_log_pool {
+    struct cobaro_log_lock lock;
     cobaro_log_t free;       // free logs
-    cobaro_log_t busy;       // currently used logs
-    pthread_spinlock_t lock; // locking
+    cobaro_log_t blocks;     // all logs, for cleanup on exit
+    char *arena;             // long strings, lh->arena bytes per log
+    uint32_t slots;          // logs in blocks
+    size_t length;           // bytes in blocks and arena
+    int node;                // NUMA node, with COBARO_LOG_POOL_NUMA
+
+    // With COBARO_LOG_POOL_PER_CPU, free logs are kept without locking
+    // instead, and the pool has a queue of its CPU's published logs.
+    // See cobaro_log_cpu_take() and cobaro_log_cpu_enqueue().
+    volatile uint64_t top;   // free logs: tag << 32 | index + 1 of first
+
+    // Written by producers on the pool's CPU.
+    volatile uint64_t enqueue // next cell to fill
+        __attribute__((aligned(COBARO_LOG_CACHELINE)));
+    struct cobaro_log_cell *cells; // mask + 1 of them
+    uint64_t mask;
+
+    // Written by the reporter, under lh->lock.
+    uint64_t dequeue         // next cell to drain
+        __attribute__((aligned(COBARO_LOG_CACHELINE)));
+} __attribute__((aligned(COBARO_LOG_CACHELINE)));
+
+// A per-CPU queue entry.  Its sequence says whose turn it is: a
+// producer's, to fill it for position sequence, or the reporter's,
+// to drain it for position sequence - 1.
+struct cobaro_log_cell {
+    volatile uint64_t sequence;
+    cobaro_log_t log;
+};
 
-    int level;               // messages higher than this are not logged
+// A filter table and its storage.  Tables are only ever grown, and a
+// replaced table may still be in use by a producer, so it is chained
+// onto the new one and freed at fini.  Policies are shared between
+// a table and its replacement.
+struct cobaro_log_filter_block {
+    struct cobaro_log_filter_block *retired;
+    struct cobaro_log_policy **policy; // per code, NULL if none
+    struct cobaro_log_filter filter; // must be last, thresholds follow
+};
+
+// The block holding the handle's current filter table.
+#define COBARO_LOG_FILTER_BLOCK(lh) \
+    ((struct cobaro_log_filter_block *) \
+     ((char *)(lh)->filter - offsetof(struct cobaro_log_filter_block, filter)))
+
+// Binary catalog, see cobaro_log_catalog_open().
+struct cobaro_log_catalog {
+    const char *base;        // file contents
+    size_t size;             // of the file
+    const struct cobaro_log_catalog_entry *entries;
+    uint32_t count;          // entries
+    bool mapped;             // base is mapped, rather than allocated
+};
+
+// Description of one code's template.
+struct cobaro_log_code {
+    struct cobaro_log_code_info info;
+    bool known;              // has a template
+    uint32_t refs[COBARO_LOG_PARAM_MAX]; // references to each parameter
+};
+
+// Descriptions of a catalog's templates, worked out when it's set, and
+// shared by the configurations using it.
+struct cobaro_log_codes {
+    uint32_t refs;           // configurations using this, under config_lock
+    struct cobaro_log_code code[]; // by code
+};
+
+// A catalog to format with.
+struct cobaro_log_language {
     char **messages;         // Array of format strings
+    const struct cobaro_log_catalog *catalog; // used instead, if set
+    uint32_t count;          // entries in messages or catalog
+    struct cobaro_log_codes *codes; // count entries
+};
+
+// A log destination.
+struct cobaro_log_sink {
     int logto;               // log destination
     FILE *f;                 // if logging to file
+    bool own;                // language is used, rather than the handle's
+    struct cobaro_log_language language;
+};
+
+// Reporting configuration.  Never modified once published: a change
+// is made to a copy, which replaces it whole, so the reporter reads
+// it without locking and sees all of a change or none of it.  A
+// replaced configuration is retired until no reporting call can still
+// be using it (see cobaro_log_config_publish()).
+struct cobaro_log_config {
+    struct cobaro_log_language language; // the handle's catalog
+    int level;               // messages higher than this are not logged
+    int sinks_count;
+    struct cobaro_log_sink sinks[COBARO_LOG_SINKS_MAX];
+    struct cobaro_log_config *retired; // next older retired config
+    uint64_t epoch;          // handle's epoch once this was replaced
+};
 
-    cobaro_log_t blocks;     // memory for cleanup on exit
+// A thread's state for a handle, made on the thread's first call and
+// kept until fini, so that threads report without writing to shared
+// cache lines.  See cobaro_log_thread().
+struct cobaro_log_thread {
+    struct cobaro_log_stats s; // see COBARO_LOG_COUNT()
+    volatile uint64_t epoch; // config epoch at the start of the outermost
+                             // reporting call under way, or zero if none
+    volatile uint32_t nesting; // reporting calls under way
+    pthread_t owner;
+    struct cobaro_log_thread *next; // in the handle's list
+} __attribute__((aligned(COBARO_LOG_CACHELINE)));
+
+// The handle is split into regions, each on its own cache lines, so
+// that producers and the reporting thread writing their own state
+// don't invalidate the configuration everyone reads.
+struct cobaro_loghandle {
+    // Read-mostly configuration, read by producers and reporter.
+    // Ordered to fit one cache line.
+    struct cobaro_log_filter *filter; // must be first, see log.h
+    struct cobaro_log_config *config; // current, see cobaro_log_config_enter()
+    struct cobaro_log_pool *pools; // free logs, by NUMA node or CPU
+    uint64_t coalesce;       // duplicate window in ns, zero if off
+    bool latency;            // stamp logs on publication
+    uint16_t pools_count;    // entries in pools
+    uint8_t pool_flags;      // cobaro_log_pool_flags in effect
+    uint32_t arena;          // long string bytes per log
+    uint64_t id;             // unique to this handle, see cobaro_log_thread()
+    volatile uint64_t epoch; // configurations published, plus one
+
+    // Queues, written by producers and reporter, under lock.
+    struct cobaro_log_lock lock
+        __attribute__((aligned(COBARO_LOG_CACHELINE))); // locking
+    cobaro_log_t busy;       // currently used logs
+    uint64_t depth;          // logs in busy
+    uint64_t depth_max;      // high water mark of depth
+    uint16_t drain;          // per-CPU queue cobaro_log_next() tries first
+
+    // Reconfiguration, by any thread, under config_lock.
+    struct cobaro_log_lock config_lock
+        __attribute__((aligned(COBARO_LOG_CACHELINE)));
+    struct cobaro_log_config *retired; // replaced configs, newest first
+    struct cobaro_log_thread *volatile threads; // by any thread, atomically
+
+    // Reporter-only state.
+    cobaro_log_t dequeued    // last log returned by cobaro_log_next()
+        __attribute__((aligned(COBARO_LOG_CACHELINE)));
+    uint64_t dequeued_at;    // and when
+    struct cobaro_log_histogram *histograms; // per cobaro_log_latencies
+    uint64_t rate_report;    // when rate limiting is next summarized
+    bool have_last;          // last is valid
+    struct cobaro_log last;  // last message reported by cobaro_log()
+    uint64_t last_hash;      // hash of last
+    uint64_t last_time;      // when last was reported
+    uint64_t last_repeat;    // when last was last repeated
+    uint32_t repeats;        // duplicates of last not reported
+
+    // Shared by threads whose own state couldn't be allocated.  Their
+    // reporting calls hold up reclaiming every retired configuration.
+    struct cobaro_log_thread stray;
 };
 
+// Catch a profile whose sizes don't add up.
+typedef char cobaro_log_record_size_check[
+    sizeof(struct cobaro_log) == COBARO_LOG_RECORD_SIZE ? 1 : -1];
+
 /// Printable version number.
 char *cobaro_log_version(void)
 {
     return VERSION;
 }
 
+int cobaro_log_abi_version(void)
+{
+    return COBARO_LOG_ABI_VERSION;
+}
+
+size_t cobaro_log_record_size(void)
+{
+    return sizeof(struct cobaro_log);
+}
+
+// Number of messages in a catalog, which ends with an empty string
+// (or NULL) entry.
+static uint32_t cobaro_log_messages_count(char **messages)
+{
+    uint32_t count = 0;
+
+    if (messages) {
+        while (messages[count] && messages[count][0]) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Monotonic time in nanoseconds.
+static uint64_t cobaro_log_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * COBARO_LOG_NS + ts.tv_nsec;
+}
+
+static int cobaro_log_format(const struct cobaro_log_language *language,
+                             cobaro_log_t log, char *s, size_t s_len);
+
+// Template for code, or NULL if there's none.
+static const char *
+cobaro_log_language_template(const struct cobaro_log_language *language,
+                             uint32_t code)
+{
+    if (language->catalog) {
+        return cobaro_log_catalog_template(language->catalog, code);
+    }
+    return code < language->count ? language->messages[code] : NULL;
+}
+
+// Describe a template, following cobaro_log_format()'s reading of it.
+static void cobaro_log_code_describe(struct cobaro_log_code *code,
+                                     const char *format)
+{
+    uint64_t length = 1; // the NUL
+
+    memset(code, 0, sizeof(*code));
+    if (!format) {
+        return;
+    }
+    code->known = true;
+
+    while (*format) {
+        if (*format++ != '%') {
+            length++;
+        } else if (*format > '0' && *format <= '0' + COBARO_LOG_PARAM_MAX) {
+            int arg = *format++ - '1';
+
+            code->refs[arg]++;
+            code->info.used |= 1u << arg;
+            code->info.params = MAX(code->info.params, (uint32_t)arg + 1);
+            length += COBARO_LOG_PARAM_WIDTH_MAX;
+        } else if (*format == '%') {
+            length++;
+            format++;
+        }
+    }
+    code->info.length_max = MIN(length, SIZE_MAX);
+}
+
+// Release a reference to codes, freeing them with the last.
+static void cobaro_log_codes_release(struct cobaro_log_codes *codes)
+{
+    if (codes && !--codes->refs) {
+        free(codes);
+    }
+}
+
+// Describe every code in language, which has its catalog set.
+static bool cobaro_log_language_describe(struct cobaro_log_language *language)
+{
+    struct cobaro_log_codes *codes;
+
+    codes = malloc(sizeof(*codes) +
+                   (size_t)language->count * sizeof(codes->code[0]));
+    if (!codes) {
+        return false;
+    }
+    codes->refs = 1;
+    for (uint32_t code = 0; code < language->count; code++) {
+        cobaro_log_code_describe(&codes->code[code],
+                                 cobaro_log_language_template(language, code));
+    }
+    language->codes = codes;
+    return true;
+}
+
+// Set language to format with messages, or catalog if it's set.  On
+// failure, language is unchanged.
+static bool cobaro_log_language_set(struct cobaro_log_language *language,
+                                    char **messages,
+                                    const struct cobaro_log_catalog *catalog)
+{
+    struct cobaro_log_language set;
+
+    set.messages = catalog ? NULL : messages;
+    set.catalog = catalog;
+    set.count = catalog ? catalog->count : cobaro_log_messages_count(messages);
+    if (!cobaro_log_language_describe(&set)) {
+        return false;
+    }
+    cobaro_log_codes_release(language->codes);
+    memcpy(language, &set, sizeof(set));
+    return true;
+}
+
+// Description of code, or NULL if it has no template.
+static const struct cobaro_log_code *
+cobaro_log_language_code(const struct cobaro_log_language *language,
+                         uint32_t code)
+{
+    if (code >= language->count || !language->codes->code[code].known) {
+        return NULL;
+    }
+    return &language->codes->code[code];
+}
+
+// Most bytes formatting log with language can need, including the NUL.
+static size_t cobaro_log_language_size(const struct cobaro_log_language *language,
+                                       cobaro_log_t log)
+{
+    const struct cobaro_log_code *code;
+    size_t size;
+
+    if (!(code = cobaro_log_language_code(language, log->code))) {
+        return COBARO_LOG_UNKNOWN_MAX;
+    }
+
+    // Static and long strings are as long as they are.
+    size = code->info.length_max;
+    for (int i = 0; i < COBARO_LOG_PARAM_MAX; i++) {
+        if (code->refs[i] &&
+            (log->p[i].type == COBARO_STATIC_STRING ||
+             log->p[i].type == COBARO_LONG_STRING) &&
+            log->p[i].v.ss.len > COBARO_LOG_PARAM_WIDTH_MAX) {
+            size += code->refs[i] *
+                (log->p[i].v.ss.len - COBARO_LOG_PARAM_WIDTH_MAX);
+        }
+    }
+    return size;
+}
+
+// Language that sink formats with.
+static const struct cobaro_log_language *
+cobaro_log_sink_language(const struct cobaro_log_config *config,
+                         const struct cobaro_log_sink *sink)
+{
+    return sink->own ? &sink->language : &config->language;
+}
+
+// Handles made, so each has an id no other will have.
+static uint64_t cobaro_log_handles;
+
+// The calling thread's state for lh, made if it has none yet, or the
+// handle's stray state if memory can't be allocated.
+static struct cobaro_log_thread *cobaro_log_thread(cobaro_loghandle_t lh)
+{
+#if defined(HAVE_THREAD_LOCAL)
+    // By handle id rather than address, as a new handle may be given
+    // a finalised one's memory.
+    static COBARO_LOG_TLS struct {
+        uint64_t id;
+        struct cobaro_log_thread *thread;
+    } cache[COBARO_LOG_THREAD_CACHE];
+    static COBARO_LOG_TLS unsigned int victim;
+#endif
+    struct cobaro_log_thread *thread, *head;
+    pthread_t self = pthread_self();
+
+#if defined(HAVE_THREAD_LOCAL)
+    for (int i = 0; i < COBARO_LOG_THREAD_CACHE; i++) {
+        if (cache[i].id == lh->id) {
+            return cache[i].thread;
+        }
+    }
+#endif
+
+    // Threads are only ever added, so the list can be read unlocked.
+    for (thread = lh->threads; thread; thread = thread->next) {
+        if (pthread_equal(thread->owner, self)) {
+            break;
+        }
+    }
+    if (!thread) {
+        if (posix_memalign((void **)&thread, COBARO_LOG_CACHELINE,
+                           sizeof(*thread))) {
+            return &lh->stray;
+        }
+        memset(thread, 0, sizeof(*thread));
+        thread->owner = self;
+        do {
+            head = lh->threads;
+            thread->next = head;
+        } while (!__sync_bool_compare_and_swap(&lh->threads, head, thread));
+    }
+
+#if defined(HAVE_THREAD_LOCAL)
+    cache[victim % COBARO_LOG_THREAD_CACHE].id = lh->id;
+    cache[victim % COBARO_LOG_THREAD_CACHE].thread = thread;
+    victim++;
+#endif
+    return thread;
+}
+
+// Start using the reporting configuration.  It stays valid, even if
+// replaced, until cobaro_log_config_leave() is called with the state
+// returned in reader.  Calls may nest.
+static const struct cobaro_log_config *
+cobaro_log_config_enter(cobaro_loghandle_t lh,
+                        struct cobaro_log_thread **reader)
+{
+    struct cobaro_log_thread *thread = *reader = cobaro_log_thread(lh);
+
+    if (thread == &lh->stray) {
+        (void) __sync_fetch_and_add(&thread->nesting, 1);
+    } else if (!thread->nesting++) {
+        thread->epoch = lh->epoch;
+        // A full barrier, so the load below can't be made before a
+        // writer could see our epoch.
+        __sync_synchronize();
+    }
+    return lh->config;
+}
+
+static void cobaro_log_config_leave(cobaro_loghandle_t lh,
+                                    struct cobaro_log_thread *reader)
+{
+    if (reader == &lh->stray) {
+        (void) __sync_fetch_and_sub(&reader->nesting, 1);
+    } else if (!--reader->nesting) {
+        // Finished with the configuration before saying so.
+        __sync_synchronize();
+        reader->epoch = 0;
+    }
+}
+
+// Oldest epoch in which a reporting call still under way started,
+// other than skip's, or UINT64_MAX if there's none.
+static uint64_t cobaro_log_epoch_oldest(cobaro_loghandle_t lh,
+                                        struct cobaro_log_thread *skip)
+{
+    struct cobaro_log_thread *thread;
+    uint64_t oldest = UINT64_MAX, epoch;
+
+    // Pairs with the barrier in cobaro_log_config_enter(): either we
+    // see its epoch, or it sees the configuration published before.
+    __sync_synchronize();
+    if (skip != &lh->stray && lh->stray.nesting) {
+        return 0;
+    }
+    for (thread = lh->threads; thread; thread = thread->next) {
+        if (thread != skip && (epoch = thread->epoch) && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+// Free config, and release its languages' descriptions.  Called with
+// config_lock held, or from cobaro_log_fini().
+static void cobaro_log_config_free(struct cobaro_log_config *config)
+{
+    cobaro_log_codes_release(config->language.codes);
+    for (int i = 0; i < config->sinks_count; i++) {
+        if (config->sinks[i].own) {
+            cobaro_log_codes_release(config->sinks[i].language.codes);
+        }
+    }
+    free(config);
+}
+
+// Free the retired configurations no reporting call can be using: those
+// replaced before the oldest call under way started.  Never waits.
+// Called with config_lock held.
+static void cobaro_log_config_reclaim(cobaro_loghandle_t lh)
+{
+    uint64_t oldest = cobaro_log_epoch_oldest(lh, NULL);
+    struct cobaro_log_config **link = &lh->retired, *config, *retired;
+
+    // Newest first, so once one can go, so can all those after it.
+    while ((config = *link) && config->epoch > oldest) {
+        link = &config->retired;
+    }
+    *link = NULL;
+    for (; config; config = retired) {
+        retired = config->retired;
+        cobaro_log_config_free(config);
+    }
+}
+
+// Start a change: take config_lock, and return a copy of the current
+// configuration to modify, or NULL (with the lock released) if memory
+// can't be allocated.
+static struct cobaro_log_config *cobaro_log_config_change(cobaro_loghandle_t lh)
+{
+    struct cobaro_log_config *config;
+
+    cobaro_log_lock_acquire(&lh->config_lock);
+    if (!(config = malloc(sizeof(*config)))) {
+        cobaro_log_lock_release(&lh->config_lock);
+        return NULL;
+    }
+    memcpy(config, lh->config, sizeof(*config));
+    config->retired = NULL;
+
+    // The copy shares the languages' descriptions.
+    config->language.codes->refs++;
+    for (int i = 0; i < config->sinks_count; i++) {
+        if (config->sinks[i].own) {
+            config->sinks[i].language.codes->refs++;
+        }
+    }
+    return config;
+}
+
+// Abandon a change started by cobaro_log_config_change().
+static void cobaro_log_config_abandon(cobaro_loghandle_t lh,
+                                      struct cobaro_log_config *config)
+{
+    cobaro_log_config_free(config);
+    cobaro_log_lock_release(&lh->config_lock);
+}
+
+// Finish a change: replace the current configuration with config,
+// retire the old one, and release config_lock.  Reporting calls pick
+// the new configuration up when they next start, and the old one is
+// freed here, or by a later change or cobaro_log_synchronize(), once
+// none is using it.
+static void cobaro_log_config_publish(cobaro_loghandle_t lh,
+                                      struct cobaro_log_config *config)
+{
+    struct cobaro_log_config *old = lh->config;
+
+    // Publish only once the copy is complete, and start a new epoch
+    // once it's published: calls starting in it can't be using old.
+    __sync_synchronize();
+    lh->config = config;
+    old->epoch = __sync_add_and_fetch(&lh->epoch, 1);
+
+    old->retired = lh->retired;
+    lh->retired = old;
+    cobaro_log_config_reclaim(lh);
+    cobaro_log_lock_release(&lh->config_lock);
+}
+
+// Make sure the filter table covers count codes, enabling any new
+// ones at level.
+static bool cobaro_log_filter_grow(cobaro_loghandle_t lh, uint32_t count,
+                                   int level)
+{
+    struct cobaro_log_filter_block *block, *old_block = NULL;
+    size_t thresholds;
+    uint32_t old = 0;
+
+    if (lh->filter && lh->filter->count >= count) {
+        return true;
+    }
+
+    // One allocation: the block, its thresholds, its policy pointers.
+    thresholds = (count + sizeof(*block->policy) - 1) &
+        ~(sizeof(*block->policy) - 1);
+    if (!(block = calloc(1, sizeof(*block) + thresholds +
+                         count * sizeof(*block->policy)))) {
+        return false;
+    }
+    block->policy = (struct cobaro_log_policy **)
+        &block->filter.threshold[thresholds];
+    block->filter.count = count;
+
+    if (lh->filter) {
+        old_block = COBARO_LOG_FILTER_BLOCK(lh);
+        old = old_block->filter.count;
+        memcpy(block->filter.threshold, old_block->filter.threshold, old);
+        memcpy(block->policy, old_block->policy, old * sizeof(*block->policy));
+    }
+    memset(&block->filter.threshold[old], level, count - old);
+    block->retired = old_block;
+
+    // Publish only once the table is complete.
+    __sync_synchronize();
+    lh->filter = &block->filter;
+    return true;
+}
+
+void cobaro_log_options_init(struct cobaro_log_options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->size = sizeof(*options);
+    options->lock = COBARO_LOG_LOCK_TTAS;
+    options->slots = COBARO_LOG_SLOTS;
+    options->pool = 0;
+    options->arena = 0;
+}
+
+// NUMA nodes that will get pools of their own, filled into node.
+// The kernel lists them as ranges, "0" or "0,2" or "0-1,4-5", and
+// node ids needn't be contiguous.  Returns the number found, which
+// is one, node 0, if they can't be read.
+static int cobaro_log_numa_nodes(int node[COBARO_LOG_NODES_MAX])
+{
+    int nodes = 0;
+#if defined(COBARO_LOG_NUMA)
+    char list[256], *p = list, *end;
+    long first, last;
+    FILE *f;
+
+    if ((f = fopen("/sys/devices/system/node/possible", "r"))) {
+        if (!fgets(list, sizeof(list), f)) {
+            list[0] = '\0';
+        }
+        fclose(f);
+        while (nodes < COBARO_LOG_NODES_MAX) {
+            first = strtol(p, &end, 10);
+            if (end == p || first < 0) {
+                break;
+            }
+            last = first;
+            if (*end == '-') {
+                p = end + 1;
+                last = strtol(p, &end, 10);
+                if (end == p || last < first) {
+                    break;
+                }
+            }
+            for (; first <= last && first < COBARO_LOG_NODE_IDS &&
+                     nodes < COBARO_LOG_NODES_MAX; first++) {
+                node[nodes++] = (int)first;
+            }
+            if (*end != ',') {
+                break;
+            }
+            p = end + 1;
+        }
+    }
+#endif
+    if (!nodes) {
+        node[nodes++] = 0;
+    }
+    return nodes;
+}
+
+// NUMA node of the calling thread.  The system call is only made
+// every so often, to notice if the thread has been migrated.
+static int cobaro_log_numa_node(void)
+{
+#if defined(COBARO_LOG_NUMA)
+    static COBARO_LOG_TLS unsigned int node, claims;
+    unsigned int cpu;
+
+    if (claims++ % COBARO_LOG_NODE_REFRESH == 0) {
+        if (syscall(SYS_getcpu, &cpu, &node, NULL)) {
+            node = 0;
+        }
+    }
+    return (int)node;
+#else
+    return 0;
+#endif
+}
+
+// Pool for the calling thread's NUMA node, or the first if its node
+// has none.
+static int cobaro_log_numa_pool(cobaro_loghandle_t lh)
+{
+    int node = cobaro_log_numa_node();
+
+    for (int i = 0; i < lh->pools_count; i++) {
+        if (lh->pools[i].node == node) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Number of CPUs that will get pools of their own.
+static int cobaro_log_cpus(void)
+{
+    long cpus = 1;
+#if defined(_SC_NPROCESSORS_CONF)
+    cpus = sysconf(_SC_NPROCESSORS_CONF);
+#endif
+    return (int)MAX(MIN(cpus, COBARO_LOG_CPUS_MAX), 1);
+}
+
+// CPU of the calling thread.  Read from the thread's restartable
+// sequence area if libc registered one, which costs a load.
+static unsigned int cobaro_log_cpu(void)
+{
+    int cpu = -1;
+
+#if defined(HAVE_RSEQ)
+    if (__rseq_size) {
+        const struct rseq *rs = (const struct rseq *)
+            ((char *)__builtin_thread_pointer() + __rseq_offset);
+
+        cpu = (int32_t)*(volatile const uint32_t *)&rs->cpu_id;
+    }
+#endif
+#if defined(HAVE_SCHED_GETCPU)
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+#endif
+    return cpu < 0 ? 0 : (unsigned int)cpu;
+}
+
+// Index + 1 of log in pool, for the per-CPU free list; 0 for none.
+static uint32_t cobaro_log_cpu_index(const struct cobaro_log_pool *pool,
+                                     cobaro_log_t log)
+{
+    return log ? (uint32_t)(log - pool->blocks) + 1 : 0;
+}
+
+// Take a log from a per-CPU pool.  The tag in top changes with every
+// update, so the swap fails if the first log was taken and given back
+// since we read it, and its next may have changed.
+static cobaro_log_t cobaro_log_cpu_take(struct cobaro_log_pool *pool)
+{
+    uint64_t top, next;
+    cobaro_log_t log;
+
+    do {
+        top = pool->top;
+        if (!(uint32_t)top) {
+            return NULL;
+        }
+        log = &pool->blocks[(uint32_t)top - 1];
+        next = (((top >> 32) + 1) << 32) | cobaro_log_cpu_index(pool, log->next);
+    } while (!__sync_bool_compare_and_swap(&pool->top, top, next));
+
+    return log;
+}
+
+// Give a log back to its per-CPU pool.  The log must be one of the
+// pool's, as found by cobaro_log_pool_of(), or its index is garbage.
+static void cobaro_log_cpu_give(struct cobaro_log_pool *pool, cobaro_log_t log)
+{
+    uint64_t top;
+
+    do {
+        top = pool->top;
+        log->next = (uint32_t)top ? &pool->blocks[(uint32_t)top - 1] : NULL;
+    } while (!__sync_bool_compare_and_swap(
+                 &pool->top, top, (((top >> 32) + 1) << 32) |
+                 cobaro_log_cpu_index(pool, log)));
+}
+
+// Add a log to a per-CPU queue.  Producers claim a position, then fill
+// its cell and pass it to the reporter.  Returns false if the queue is
+// full, which can only happen if logs claimed on other CPUs are
+// published on this one.
+static bool cobaro_log_cpu_enqueue(struct cobaro_log_pool *pool,
+                                   cobaro_log_t log)
+{
+    struct cobaro_log_cell *cell;
+    uint64_t position = pool->enqueue;
+    int64_t turn;
+
+    for (;;) {
+        cell = &pool->cells[position & pool->mask];
+        turn = (int64_t)(cell->sequence - position);
+        if (turn == 0) {
+            if (__sync_bool_compare_and_swap(&pool->enqueue, position,
+                                             position + 1)) {
+                break;
+            }
+            position = pool->enqueue;
+        } else if (turn < 0) {
+            return false; // not drained since last time round
+        } else {
+            position = pool->enqueue; // another producer took it
+        }
+    }
+
+    cell->log = log;
+    __sync_synchronize();
+    cell->sequence = position + 1;
+    return true;
+}
+
+// Take the oldest log from a per-CPU queue, if it's been published.
+// Called with lh->lock held.
+static cobaro_log_t cobaro_log_cpu_dequeue(struct cobaro_log_pool *pool)
+{
+    struct cobaro_log_cell *cell = &pool->cells[pool->dequeue & pool->mask];
+    cobaro_log_t log;
+
+    if (cell->sequence != pool->dequeue + 1) {
+        return NULL;
+    }
+    __sync_synchronize();
+    log = cell->log;
+    cell->sequence = pool->dequeue + pool->mask + 1;
+    pool->dequeue++;
+    return log;
+}
+
+// Allocate a pool's logs and thread its free list.  Flags that can't
+// be honoured are cleared from the handle's pool_flags.
+static bool cobaro_log_pool_alloc(cobaro_loghandle_t lh, uint8_t index,
+                                  uint32_t slots)
+{
+    struct cobaro_log_pool *pool = &lh->pools[index];
+    size_t length = slots * (sizeof(struct cobaro_log) + lh->arena);
+    void *memory = NULL;
+
+#if defined(COBARO_LOG_MMAP)
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    memory = MAP_FAILED;
+# if defined(MAP_HUGETLB)
+    if (lh->pool_flags & COBARO_LOG_POOL_HUGEPAGES) {
+        size_t huge = (length + COBARO_LOG_HUGEPAGE - 1) & ~(size_t)(COBARO_LOG_HUGEPAGE - 1);
+
+        memory = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            length = huge;
+        }
+    }
+# endif
+    if (memory == MAP_FAILED) {
+        lh->pool_flags &= ~COBARO_LOG_POOL_HUGEPAGES;
+        length = (length + page - 1) & ~(page - 1);
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+    }
+# if defined(COBARO_LOG_NUMA)
+    // Must precede first touch, which is below.
+    if (lh->pool_flags & COBARO_LOG_POOL_NUMA) {
+        unsigned long mask[COBARO_LOG_NODE_IDS / (sizeof(unsigned long) * 8)];
+        size_t bits = sizeof(mask[0]) * 8;
+
+        memset(mask, 0, sizeof(mask));
+        mask[pool->node / bits] = 1ul << (pool->node % bits);
+        if (syscall(SYS_mbind, memory, length, COBARO_LOG_MPOL_PREFERRED,
+                    mask, sizeof(mask) * 8, 0)) {
+            lh->pool_flags &= ~COBARO_LOG_POOL_NUMA;
+        }
+    }
+# endif
+#else
+    lh->pool_flags &= ~COBARO_LOG_POOL_HUGEPAGES;
+    if (!(memory = calloc(1, length))) {
+        return false;
+    }
+#endif
+    pool->blocks = (cobaro_log_t)memory;
+    pool->arena = (char *)&pool->blocks[slots];
+    pool->slots = slots;
+    pool->length = length;
+
+    if (lh->pool_flags & COBARO_LOG_POOL_MLOCK) {
+#if defined(HAVE_MLOCK)
+        if (mlock(memory, length)) {
+            lh->pool_flags &= ~COBARO_LOG_POOL_MLOCK;
+        }
+#else
+        lh->pool_flags &= ~COBARO_LOG_POOL_MLOCK;
+#endif
+    }
+
+    // Threading the free list writes to every log, and clearing the
+    // arena to every string, so this also faults in the whole pool
+    // now rather than on first claim.
+    for (uint32_t i = 0; i < slots; i++) {
+        pool->blocks[i].pool = index;
+        pool->blocks[i].next = i + 1 < slots ? &pool->blocks[i + 1] : NULL;
+    }
+    memset(pool->arena, 0, (size_t)slots * lh->arena);
+    pool->free = pool->blocks;
+    cobaro_log_lock_init(&pool->lock, lh->lock.kind);
+
+    if (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) {
+        // Room for twice the pool, so that logs from other CPUs
+        // rarely find it full, rounded up for masking.
+        uint64_t cells = 1;
+
+        while (cells < 2 * (uint64_t)slots) {
+            cells <<= 1;
+        }
+        if (!(pool->cells = calloc(cells, sizeof(*pool->cells)))) {
+            return false;
+        }
+        for (uint64_t i = 0; i < cells; i++) {
+            pool->cells[i].sequence = i;
+        }
+        pool->mask = cells - 1;
+        pool->top = cobaro_log_cpu_index(pool, pool->free);
+    }
+
+    return true;
+}
+
+// Release a pool's logs.
+static void cobaro_log_pool_free(struct cobaro_log_pool *pool)
+{
+    free(pool->cells);
+    if (pool->blocks) {
+#if defined(COBARO_LOG_MMAP)
+        (void)munmap(pool->blocks, pool->length);
+#else
+        free(pool->blocks);
+#endif
+    }
+}
+
  // Per-thread
  cobaro_loghandle_t cobaro_log_init(char **messages)
  {
+     return cobaro_log_init_with(messages, NULL);
+ }
+
+ cobaro_loghandle_t cobaro_log_init_with(char **messages,
+                                         const struct cobaro_log_options *options)
+ {
+     struct cobaro_log_options opts;
+     int nodes[COBARO_LOG_NODES_MAX];
      cobaro_loghandle_t lh;
 
-     if (!(lh = (cobaro_loghandle_t) calloc(1, sizeof(struct cobaro_loghandle)))) {
+     // Take what the caller's version of the structure has, and
+     // defaults for the rest.
+     cobaro_log_options_init(&opts);
+     if (options) {
+         if (options->size < sizeof(options->size)) {
+             return NULL;
+         }
+         memcpy(&opts, options, MIN(options->size, sizeof(opts)));
+         opts.size = sizeof(opts);
+     }
+     if (opts.lock < 0 || opts.lock >= COBARO_LOG_LOCKS_COUNT ||
+         !opts.slots || opts.arena > UINT16_MAX || (opts.pool & ~(COBARO_LOG_POOL_HUGEPAGES |
+                                       COBARO_LOG_POOL_MLOCK |
+                                       COBARO_LOG_POOL_NUMA |
+                                       COBARO_LOG_POOL_PER_CPU))) {
          return NULL;
      }
 
-     // let's get them all as a bunch in memory. After this they can
-     // get jumbled up but on shutdown we can free the lot in one
-     // go
-     lh->blocks = (cobaro_log_t) calloc(COBARO_LOG_SLOTS, sizeof(struct cobaro_log));
-     for (int i = 0; i < COBARO_LOG_SLOTS - 1; i++) {
-         lh->blocks[i].next = &lh->blocks[i + 1];
+     // Aligned, so that the handle's regions start on cache lines.
+     if (posix_memalign((void **)&lh, COBARO_LOG_CACHELINE,
+                        sizeof(struct cobaro_loghandle))) {
+         return NULL;
      }
-
-     lh->free = lh->blocks;
+     memset(lh, 0, sizeof(struct cobaro_loghandle));
+     lh->id = __sync_add_and_fetch(&cobaro_log_handles, 1);
+     lh->epoch = 1;
+     cobaro_log_lock_init(&lh->lock, opts.lock);
+     cobaro_log_lock_init(&lh->config_lock, opts.lock);
      lh->busy = NULL;
-     if (pthread_spin_init(&lh->lock, 1)) {
-         fprintf(stderr, "pthread_spin_init() failed\n");
-         abort();
+
+     // let's get them all as a bunch in memory, one bunch per NUMA
+     // node if asked. After this they can get jumbled up but on
+     // shutdown we can free each lot in one go
+     lh->pool_flags = opts.pool;
+     lh->arena = opts.arena;
+     lh->pools_count = 1;
+     if (opts.pool & COBARO_LOG_POOL_PER_CPU) {
+         lh->pools_count = cobaro_log_cpus();
+         lh->pool_flags &= ~COBARO_LOG_POOL_NUMA;
+     } else if (opts.pool & COBARO_LOG_POOL_NUMA) {
+         lh->pools_count = cobaro_log_numa_nodes(nodes);
+         if (lh->pools_count == 1) {
+             lh->pool_flags &= ~COBARO_LOG_POOL_NUMA;
+         }
+     }
+     if (posix_memalign((void **)&lh->pools, COBARO_LOG_CACHELINE,
+                        lh->pools_count * sizeof(*lh->pools))) {
+         lh->pools_count = 0;
+         cobaro_log_fini(lh);
+         return NULL;
+     }
+     memset(lh->pools, 0, lh->pools_count * sizeof(*lh->pools));
+     for (uint16_t i = 0; i < lh->pools_count; i++) {
+         // Share the slots out, rounding up, unless each CPU has its own
+         uint32_t slots = (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) ?
+             opts.slots : (opts.slots + lh->pools_count - 1) / lh->pools_count;
+
+         if (lh->pool_flags & COBARO_LOG_POOL_NUMA) {
+             lh->pools[i].node = nodes[i];
+         }
+         if (!cobaro_log_pool_alloc(lh, i, slots)) {
+             cobaro_log_fini(lh);
+             return NULL;
+         }
+     }
+
+     if (!(lh->config = calloc(1, sizeof(*lh->config)))) {
+         cobaro_log_fini(lh);
+         return NULL;
+     }
+     lh->config->sinks[0].logto = COBARO_LOGTO_FILE; // default
+     lh->config->sinks[0].f = stdout;                // default
+     lh->config->sinks_count = 1;
+     lh->config->level = LOG_INFO;          // By default
+     if (!cobaro_log_language_set(&lh->config->language, messages,
+                                  opts.catalog) ||
+         !cobaro_log_filter_grow(lh, lh->config->language.count, LOG_INFO)) {
+         cobaro_log_fini(lh);
+         return NULL;
      }
 
-     lh->logto = COBARO_LOGTO_FILE; // default
-     lh->f = stdout;                // default
-     lh->level = LOG_INFO;          // By default
-     lh->messages = messages;
-     
      return lh;
  }
 
  void cobaro_log_fini(cobaro_loghandle_t lh)
  {
      if (lh) {
-         free(lh->blocks);
-         pthread_spin_destroy(&lh->lock);
+         struct cobaro_log_filter_block *block, *retired;
+         struct cobaro_log_config *config, *older;
+         struct cobaro_log_thread *thread, *next;
+
+         if (lh->config) {
+             cobaro_log_config_free(lh->config);
+         }
+         for (config = lh->retired; config; config = older) {
+             older = config->retired;
+             cobaro_log_config_free(config);
+         }
+
+         block = lh->filter ? COBARO_LOG_FILTER_BLOCK(lh) : NULL;
+         if (block) {
+             for (uint32_t code = 0; code < block->filter.count; code++) {
+                 free(block->policy[code]);
+             }
+         }
+         while (block) {
+             retired = block->retired;
+             free(block);
+             block = retired;
+         }
+         for (uint16_t i = 0; i < lh->pools_count; i++) {
+             cobaro_log_pool_free(&lh->pools[i]);
+         }
+         free(lh->pools);
+         for (thread = lh->threads; thread; thread = next) {
+             next = thread->next;
+             free(thread);
+         }
+         free(lh->histograms);
          free(lh);
          lh = NULL;
      }
@@ -132,74 +1247,582 @@ char *cobaro_log_version(void)
 
  void cobaro_log_messages_set(cobaro_loghandle_t lh, char **messages)
  {
-     lh->messages = messages;
+     struct cobaro_log_config *config;
+
+     if (!(config = cobaro_log_config_change(lh))) {
+         return;
+     }
+     if (!cobaro_log_language_set(&config->language, messages, NULL)) {
+         cobaro_log_config_abandon(lh, config);
+         return;
+     }
+
+     // Grow first, so there's never a code in the catalog that the
+     // producers can't test.
+     (void) cobaro_log_filter_grow(lh, config->language.count, config->level);
+     cobaro_log_config_publish(lh, config);
      return;
  }
 
+#if !defined(COBARO_LOG_MMAP)
+// Read all of fd into a new buffer of size bytes.
+static char *cobaro_log_read_all(int fd, size_t size)
+{
+    char *buffer = malloc(size);
+    size_t done = 0;
+    ssize_t ret;
+
+    while (buffer && done < size) {
+        if ((ret = read(fd, &buffer[done], size - done)) <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (!ret) {
+                errno = EINVAL; // shrank under us
+            }
+            free(buffer);
+            return NULL;
+        }
+        done += ret;
+    }
+    return buffer;
+}
+#endif
+
+struct cobaro_log_catalog *cobaro_log_catalog_open(const char *path)
+{
+    const struct cobaro_log_catalog_header *header;
+    struct cobaro_log_catalog *catalog;
+    struct stat st;
+    int fd, saved;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    if (st.st_size < (off_t)sizeof(*header) || st.st_size > UINT32_MAX) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!(catalog = calloc(1, sizeof(*catalog)))) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    catalog->size = st.st_size;
+
+#if defined(COBARO_LOG_MMAP)
+    // Shared, so that every process using the file uses the same pages.
+    catalog->base = mmap(NULL, catalog->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (catalog->base == MAP_FAILED) {
+        catalog->base = NULL;
+    } else {
+        catalog->mapped = true;
+    }
+#else
+    catalog->base = cobaro_log_read_all(fd, catalog->size);
+#endif
+    saved = errno;
+    close(fd);
+    if (!catalog->base) {
+        free(catalog);
+        errno = saved;
+        return NULL;
+    }
+
+    // Only the header is checked here, so opening doesn't touch the
+    // rest of the file; entries are checked as they're looked up.
+    header = (const struct cobaro_log_catalog_header *)catalog->base;
+    if (memcmp(header->magic, COBARO_LOG_CATALOG_MAGIC,
+               sizeof(header->magic)) ||
+        header->version != COBARO_LOG_CATALOG_VERSION ||
+        header->size != catalog->size ||
+        header->count > (catalog->size - sizeof(*header)) /
+                        sizeof(struct cobaro_log_catalog_entry)) {
+        cobaro_log_catalog_close(catalog);
+        errno = EINVAL;
+        return NULL;
+    }
+    catalog->entries = (const struct cobaro_log_catalog_entry *)&header[1];
+    catalog->count = header->count;
+    return catalog;
+}
+
+void cobaro_log_catalog_close(struct cobaro_log_catalog *catalog)
+{
+    if (catalog) {
+#if defined(COBARO_LOG_MMAP)
+        if (catalog->mapped) {
+            munmap((void *)catalog->base, catalog->size);
+        }
+#else
+        free((void *)catalog->base);
+#endif
+        free(catalog);
+    }
+}
+
+uint32_t cobaro_log_catalog_count(const struct cobaro_log_catalog *catalog)
+{
+    return catalog->count;
+}
+
+const char *cobaro_log_catalog_template(
+    const struct cobaro_log_catalog *catalog, uint32_t code)
+{
+    const struct cobaro_log_catalog_entry *entry;
+
+    if (code >= catalog->count) {
+        return NULL;
+    }
+
+    // The template, and its NUL, must be within the file.
+    entry = &catalog->entries[code];
+    if (entry->offset >= catalog->size ||
+        entry->length >= catalog->size - entry->offset ||
+        catalog->base[entry->offset + entry->length] != '\0') {
+        return NULL;
+    }
+    return &catalog->base[entry->offset];
+}
+
+bool cobaro_log_catalog_set(cobaro_loghandle_t lh,
+                            const struct cobaro_log_catalog *catalog)
+{
+    struct cobaro_log_config *config;
+
+    if (!(config = cobaro_log_config_change(lh))) {
+        return false;
+    }
+    // Grow first, as for cobaro_log_messages_set().
+    if (!cobaro_log_language_set(&config->language, NULL, catalog) ||
+        !cobaro_log_filter_grow(lh, config->language.count, config->level)) {
+        cobaro_log_config_abandon(lh, config);
+        return false;
+    }
+    cobaro_log_config_publish(lh, config);
+    return true;
+}
+
+void cobaro_log_synchronize(cobaro_loghandle_t lh)
+{
+    struct cobaro_log_thread *self = cobaro_log_thread(lh);
+    uint64_t epoch;
+
+    // Everything replaced so far was replaced by this epoch, so wait
+    // for other threads' calls that started earlier to finish.  Not
+    // under config_lock, so others can change the configuration
+    // meanwhile.  Our own call, if we're in one, is our business.
+    __sync_synchronize();
+    epoch = lh->epoch;
+    while (cobaro_log_epoch_oldest(lh, self) < epoch) {
+        sched_yield();
+    }
+
+    cobaro_log_lock_acquire(&lh->config_lock);
+    cobaro_log_config_reclaim(lh);
+    cobaro_log_lock_release(&lh->config_lock);
+}
+
+int cobaro_log_pool_flags(cobaro_loghandle_t lh)
+{
+    return lh->pool_flags;
+}
+
+// The pool log came from, or NULL if it isn't one of this handle's,
+// such as a log the caller built itself.
+static struct cobaro_log_pool *cobaro_log_pool_of(cobaro_loghandle_t lh,
+                                                  cobaro_log_t log)
+{
+    struct cobaro_log_pool *pool;
+
+    if (log->pool >= lh->pools_count) {
+        return NULL;
+    }
+    pool = &lh->pools[log->pool];
+    if ((uintptr_t)log < (uintptr_t)pool->blocks ||
+        (uintptr_t)log >= (uintptr_t)&pool->blocks[pool->slots]) {
+        return NULL;
+    }
+    return pool;
+}
+
  cobaro_log_t cobaro_log_claim(cobaro_loghandle_t lh)
  {
-     int ret;
-     cobaro_log_t log;
+     struct cobaro_log_pool *pool;
+     cobaro_log_t log = NULL;
+     int local = 0;
 
-     if ((ret = pthread_spin_lock(&lh->lock))) {
-         fprintf(stderr, "spin_lock failed %d\n", ret);
+     if (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) {
+         local = cobaro_log_cpu() % lh->pools_count;
+     } else if (lh->pools_count > 1) {
+         local = cobaro_log_numa_pool(lh);
      }
 
-     // We can always take from the free list
-     log = lh->free;
-     if (log) {
-         lh->free = log->next;
+     // We can always take from a free list, preferably our node's or CPU's
+     for (int i = 0; !log && i < lh->pools_count; i++) {
+         pool = &lh->pools[(local + i) % lh->pools_count];
+         if (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) {
+             log = cobaro_log_cpu_take(pool);
+             continue;
+         }
+         cobaro_log_lock_acquire(&pool->lock);
+         log = pool->free;
+         if (log) {
+             pool->free = log->next;
+         }
+         cobaro_log_lock_release(&pool->lock);
      }
 
-     if ((ret = pthread_spin_unlock(&lh->lock))) {
-         fprintf(stderr, "spin_unlock failed %d\n", ret);
+     if (log) {
+         log->sample = 1; // unless cobaro_log_claim_code() says otherwise
+         log->arena_used = 0;
+         COBARO_LOG_COUNT(lh, claims, 1);
+     } else {
+         COBARO_LOG_COUNT(lh, claim_failures, 1);
      }
 
      return log;
  }
 
-void cobaro_log_set_string(cobaro_log_t log, int argnum, const char *source)
+// Take a token from a bucket, or count the message as suppressed.
+static bool cobaro_log_bucket_take(struct cobaro_log_bucket *b, uint64_t now)
+{
+    uint64_t tat, next;
+
+    do {
+        tat = b->tat;
+        next = MAX(tat, now);
+        if (next - now > b->tolerance) {
+            __sync_fetch_and_add(&b->suppressed, 1);
+            return false;
+        }
+    } while (!__sync_bool_compare_and_swap(&b->tat, tat, next + b->interval));
+
+    return true;
+}
+
+// Per-thread xorshift64* generator, seeded on first use.
+static uint64_t cobaro_log_random(void)
+{
+    static COBARO_LOG_TLS uint64_t state;
+
+    if (!state) {
+        state = cobaro_log_now_ns() ^ (uintptr_t)&state;
+        state |= 1;
+    }
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+}
+
+// Decide whether to keep a message, returning its sampling rate if
+// so, or zero if not.
+static uint32_t cobaro_log_sample_keep(struct cobaro_log_sample *sample)
+{
+    uint64_t second, now;
+
+    switch (sample->mode) {
+    case COBARO_LOG_SAMPLE_RATIO:
+        return cobaro_log_random() < sample->limit ? sample->n : 0;
+
+    case COBARO_LOG_SAMPLE_EVERY:
+        return __sync_fetch_and_add(&sample->count, 1) % sample->n ? 0 : sample->n;
+
+    case COBARO_LOG_SAMPLE_FIRST:
+        now = cobaro_log_now_ns();
+        second = sample->second;
+        if (now / COBARO_LOG_NS != second &&
+            __sync_bool_compare_and_swap(&sample->second, second,
+                                         now / COBARO_LOG_NS)) {
+            sample->kept = 0;
+        }
+        if (__sync_add_and_fetch(&sample->kept, 1) > sample->n) {
+            __sync_fetch_and_add(&sample->skipped, 1);
+            return 0;
+        }
+        return 1 + __sync_lock_test_and_set(&sample->skipped, 0);
+    }
+
+    return 1;
+}
+
+// Apply any rate limits for this code and level.
+static bool cobaro_log_policy_allows(struct cobaro_log_policy *policy,
+                                     int level)
+{
+    struct cobaro_log_bucket *all = &policy->bucket[COBARO_LOG_LEVELS_COUNT];
+    struct cobaro_log_bucket *one = &policy->bucket[level];
+    uint64_t now = cobaro_log_now_ns();
+
+    if (all->interval && !cobaro_log_bucket_take(all, now)) {
+        return false;
+    }
+    if (one->interval && !cobaro_log_bucket_take(one, now)) {
+        return false;
+    }
+    return true;
+}
+
+cobaro_log_t cobaro_log_claim_code(cobaro_loghandle_t lh,
+                                   uint32_t code, int level)
+{
+    struct cobaro_log_policy *policy;
+    uint32_t sample = 1;
+    cobaro_log_t log;
+
+    if (!cobaro_log_enabled(lh, code, level)) {
+        COBARO_LOG_COUNT(lh, filtered[COBARO_LOG_LEVEL_INDEX(level)], 1);
+        return NULL;
+    }
+
+    // enabled() has bounded both code and level
+    policy = COBARO_LOG_FILTER_BLOCK(lh)->policy[code];
+    if (policy) {
+        if (!(sample = cobaro_log_sample_keep(&policy->sample))) {
+            COBARO_LOG_COUNT(lh, sampled_out, 1);
+            return NULL;
+        }
+        if (!cobaro_log_policy_allows(policy, level)) {
+            COBARO_LOG_COUNT(lh, rate_limited, 1);
+            return NULL;
+        }
+    }
+
+    if ((log = cobaro_log_claim(lh))) {
+        log->code = code;
+        log->level = level;
+        log->sample = sample;
+    }
+    return log;
+}
+
+bool cobaro_log_code_enable(cobaro_loghandle_t lh, uint32_t code, bool enable)
+{
+    struct cobaro_log_filter *filter;
+    bool ok = false;
+
+    // Locked, so that neither a level change nor a table grown by a new
+    // catalog can lose the update.
+    cobaro_log_lock_acquire(&lh->config_lock);
+    filter = lh->filter;
+    if (code < filter->count) {
+        filter->threshold[code] = enable ? lh->config->level : -1;
+        ok = true;
+    }
+    cobaro_log_lock_release(&lh->config_lock);
+    return ok;
+}
+
+// Find, or make, the policy for a code.  Called with config_lock held,
+// so that a policy is made once and is in the table that a new
+// catalog's table copies.
+static struct cobaro_log_policy *cobaro_log_policy_get(cobaro_loghandle_t lh,
+                                                       uint32_t code)
+{
+    struct cobaro_log_filter_block *block;
+
+    block = COBARO_LOG_FILTER_BLOCK(lh);
+    if (code >= block->filter.count) {
+        return NULL;
+    }
+
+    if (!block->policy[code]) {
+        struct cobaro_log_policy *policy = calloc(1, sizeof(*policy));
+        if (!policy) {
+            return NULL;
+        }
+        __sync_synchronize();
+        block->policy[code] = policy;
+    }
+    return block->policy[code];
+}
+
+bool cobaro_log_sample_set(cobaro_loghandle_t lh, uint32_t code,
+                           int mode, uint32_t n)
+{
+    struct cobaro_log_policy *policy;
+    struct cobaro_log_sample *sample;
+
+    if (mode < COBARO_LOG_SAMPLE_NONE || mode > COBARO_LOG_SAMPLE_FIRST ||
+        (mode != COBARO_LOG_SAMPLE_NONE && !n)) {
+        return false;
+    }
+    cobaro_log_lock_acquire(&lh->config_lock);
+    if (!(policy = cobaro_log_policy_get(lh, code))) {
+        cobaro_log_lock_release(&lh->config_lock);
+        return false;
+    }
+
+    // Producers see the new mode only once its parameters are set.
+    sample = &policy->sample;
+    sample->mode = COBARO_LOG_SAMPLE_NONE;
+    __sync_synchronize();
+    sample->n = n;
+    sample->limit = n ? UINT64_MAX / n : 0;
+    sample->count = 0;
+    sample->kept = 0;
+    sample->skipped = 0;
+    __sync_synchronize();
+    sample->mode = mode;
+    cobaro_log_lock_release(&lh->config_lock);
+    return true;
+}
+
+bool cobaro_log_rate_limit_set(cobaro_loghandle_t lh, uint32_t code,
+                               int level, double rate, uint32_t burst)
+{
+    struct cobaro_log_policy *policy;
+    struct cobaro_log_bucket *b;
+
+    if (level < -1 || level >= COBARO_LOG_LEVELS_COUNT ||
+        !isfinite(rate) || rate < 0) {
+        return false;
+    }
+    cobaro_log_lock_acquire(&lh->config_lock);
+    if (!(policy = cobaro_log_policy_get(lh, code))) {
+        cobaro_log_lock_release(&lh->config_lock);
+        return false;
+    }
+
+    b = &policy->bucket[level < 0 ? COBARO_LOG_LEVELS_COUNT : level];
+    if (rate == 0) {
+        b->interval = 0;
+    } else {
+        // Sub-nanosecond intervals aren't a limit worth having, and
+        // less than one a year is as good as none at all.
+        double ns = COBARO_LOG_NS / rate;
+        uint64_t interval = ns < COBARO_LOG_RATE_INTERVAL_MAX ?
+            MAX((uint64_t)ns, 1) : COBARO_LOG_RATE_INTERVAL_MAX;
+        uint32_t ahead = MAX(burst, 1) - 1;
+
+        b->tolerance = ahead < COBARO_LOG_RATE_TOLERANCE_MAX / interval ?
+            ahead * interval : COBARO_LOG_RATE_TOLERANCE_MAX;
+        __sync_synchronize();
+        b->interval = interval;
+    }
+    cobaro_log_lock_release(&lh->config_lock);
+    return true;
+}
+
+void cobaro_log_set_string(cobaro_log_t log, int argnum, const char *source)
+{
+    cobaro_log_set_string_inline(log, argnum, source);
+}
+
+void cobaro_log_set_static_string(cobaro_log_t log, int argnum,
+                                  const char *source, size_t length)
+{
+    cobaro_log_set_static_string_inline(log, argnum, source, length);
+}
+
+bool cobaro_log_set_long_string(cobaro_loghandle_t lh, cobaro_log_t log,
+                                int argnum, const char *source)
+{
+    int index = argnum - 1;
+    struct cobaro_log_pool *pool;
+    size_t length, room;
+    char *region;
+
+    if (index < 0 || index >= COBARO_LOG_PARAM_MAX) {
+        return false;
+    }
+
+    // Only logs from this handle's pools have a region in its arena.
+    pool = log->pool < lh->pools_count ? &lh->pools[log->pool] : NULL;
+    if (!lh->arena || !pool ||
+        log < pool->blocks || log >= &pool->blocks[pool->slots]) {
+        cobaro_log_set_string(log, argnum, source);
+        return strlen(source) < sizeof(log->p[index].v.s);
+    }
+
+    // The log's region is bump allocated, and reset when it's claimed,
+    // so no other thread is involved.
+    region = &pool->arena[(size_t)(log - pool->blocks) * lh->arena];
+    room = lh->arena - log->arena_used;
+    length = strnlen(source, room);
+    memcpy(&region[log->arena_used], source, length);
+
+    log->p[index].type = COBARO_LONG_STRING;
+    log->p[index].v.ss.s = &region[log->arena_used];
+    log->p[index].v.ss.len = length;
+    log->arena_used += length;
+
+    return length < room || !source[length];
+}
+
+void cobaro_log_set_integer(cobaro_log_t log, int argnum, int64_t source)
+{
+    cobaro_log_set_integer_inline(log, argnum, source);
+}
+
+void cobaro_log_set_double(cobaro_log_t log, int argnum, double source)
+{
+    cobaro_log_set_double_inline(log, argnum, source);
+}
+
+void cobaro_log_set_ipv4(cobaro_log_t log, int argnum, uint32_t ipv4)
+{
+    cobaro_log_set_ipv4_inline(log, argnum, ipv4);
+}
+
+void cobaro_log_set_uint64(cobaro_log_t log, int argnum, uint64_t source)
+{
+    cobaro_log_set_uint64_inline(log, argnum, source);
+}
+
+void cobaro_log_set_hex(cobaro_log_t log, int argnum, uint64_t source)
+{
+    cobaro_log_set_hex_inline(log, argnum, source);
+}
+
+void cobaro_log_set_bool(cobaro_log_t log, int argnum, bool source)
+{
+    cobaro_log_set_bool_inline(log, argnum, source);
+}
+
+void cobaro_log_set_ipv6(cobaro_log_t log, int argnum, const uint8_t *source)
 {
-    // 'argnum' is the %n number, which is 1-based; index is for the
-    // array, which is 0-based, so convert here once, and use index
-    // hereafter.
-    int index = argnum - 1;
-    log->p[index].type = COBARO_STRING;
-    strncpy(log->p[index].v.s, source, sizeof(log->p[index].v.s));
-    log->p[index].v.s[sizeof(log->p[index].v.s) - 1] = '\0';
+    cobaro_log_set_ipv6_inline(log, argnum, source);
 }
 
-void cobaro_log_set_integer(cobaro_log_t log, int argnum, int64_t source)
+void cobaro_log_set_pointer(cobaro_log_t log, int argnum, const void *source)
 {
-    int index = argnum - 1;
-    log->p[index].type = COBARO_INTEGER;
-    log->p[index].v.i = source;
+    cobaro_log_set_pointer_inline(log, argnum, source);
 }
 
-void cobaro_log_set_double(cobaro_log_t log, int argnum, double source)
+void cobaro_log_set_duration_ns(cobaro_log_t log, int argnum, int64_t source)
 {
-    int index = argnum - 1;
-    log->p[index].type = COBARO_REAL;
-    log->p[index].v.f = source;
+    cobaro_log_set_duration_ns_inline(log, argnum, source);
 }
 
-void cobaro_log_set_ipv4(cobaro_log_t log, int argnum, uint32_t ipv4)
+void cobaro_log_set_timestamp(cobaro_log_t log, int argnum, uint64_t source)
 {
-    int index = argnum - 1;
-    log->p[index].type = COBARO_IPV4;
-    log->p[index].v.ipv4 = ipv4;
+    cobaro_log_set_timestamp_inline(log, argnum, source);
 }
 
  void cobaro_log_publish(cobaro_loghandle_t lh, cobaro_log_t log)
  {
-     int ret;
-
      log->next = NULL;
-
-     if ((ret = pthread_spin_lock(&lh->lock))) {
-         fprintf(stderr, "spin_lock failed %d\n", ret);
+     log->published = lh->latency ? cobaro_log_now_ns() : 0;
+
+     // To our CPU's queue, or if it's full, the shared one.
+     if ((lh->pool_flags & COBARO_LOG_POOL_PER_CPU) &&
+         cobaro_log_cpu_enqueue(&lh->pools[cobaro_log_cpu() % lh->pools_count],
+                                log)) {
+         COBARO_LOG_COUNT(lh, publishes, 1);
+         return;
      }
 
+     cobaro_log_lock_acquire(&lh->lock);
+
      if (!lh->busy) {
          lh->busy = log;
      } else {
@@ -209,29 +1832,137 @@ void cobaro_log_set_ipv4(cobaro_log_t log, int argnum, uint32_t ipv4)
          }
          tail->next = log;
      }
-     if ((ret = pthread_spin_unlock(&lh->lock))) {
-         fprintf(stderr, "spin_unlock failed %d\n", ret);
+     if (++lh->depth > lh->depth_max) {
+         lh->depth_max = lh->depth;
      }
+     cobaro_log_lock_release(&lh->lock);
 
+     COBARO_LOG_COUNT(lh, publishes, 1);
      return;
  }
 
+// Histogram bucket for a value.
+static int cobaro_log_histogram_bucket(uint64_t value)
+{
+    int msb;
+
+    if (value < COBARO_LOG_HIST_SUB) {
+        return value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    return (msb - COBARO_LOG_HIST_SUB_BITS + 1) * COBARO_LOG_HIST_SUB +
+        ((value >> (msb - COBARO_LOG_HIST_SUB_BITS)) & (COBARO_LOG_HIST_SUB - 1));
+}
+
+// Highest value that falls in a histogram bucket.
+static uint64_t cobaro_log_histogram_value(int bucket)
+{
+    int shift;
+
+    if (bucket < COBARO_LOG_HIST_SUB) {
+        return bucket;
+    }
+    shift = bucket / COBARO_LOG_HIST_SUB - 1;
+    return ((uint64_t)(COBARO_LOG_HIST_SUB + bucket % COBARO_LOG_HIST_SUB + 1)
+            << shift) - 1;
+}
+
+static void cobaro_log_latency_record(cobaro_loghandle_t lh, int latency,
+                                      uint64_t ns)
+{
+    struct cobaro_log_histogram *h = &lh->histograms[latency];
+
+    __sync_fetch_and_add(&h->bucket[cobaro_log_histogram_bucket(ns)], 1);
+    __sync_fetch_and_add(&h->count, 1);
+}
+
+// Record the write latency of a log that was just reported.
+static void cobaro_log_latency_written(cobaro_loghandle_t lh, cobaro_log_t log)
+{
+    if (log == lh->dequeued && lh->histograms) {
+        cobaro_log_latency_record(lh, COBARO_LOG_LATENCY_WRITE,
+                                  cobaro_log_now_ns() - lh->dequeued_at);
+        lh->dequeued = NULL;
+    }
+}
+
+bool cobaro_log_latency_enable(cobaro_loghandle_t lh, bool enable)
+{
+    if (enable && !lh->histograms) {
+        if (!(lh->histograms = calloc(COBARO_LOG_LATENCIES_COUNT,
+                                      sizeof(*lh->histograms)))) {
+            return false;
+        }
+    }
+    lh->latency = enable;
+    return true;
+}
+
+uint64_t cobaro_log_latency_percentile(cobaro_loghandle_t lh, int latency,
+                                       double percentile)
+{
+    struct cobaro_log_histogram *h;
+    uint64_t rank, seen = 0;
+
+    if (!lh->histograms || latency < 0 || latency >= COBARO_LOG_LATENCIES_COUNT) {
+        return 0;
+    }
+    h = &lh->histograms[latency];
+    if (!h->count) {
+        return 0;
+    }
+
+    // The smallest value with at least percentile% of counts at or below.
+    rank = (uint64_t)(MAX(MIN(percentile, 100.0), 0.0) / 100.0 * h->count + 0.5);
+    rank = MAX(rank, 1);
+    for (int i = 0; i < COBARO_LOG_HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            return cobaro_log_histogram_value(i);
+        }
+    }
+    return cobaro_log_histogram_value(COBARO_LOG_HIST_BUCKETS - 1);
+}
+
+void cobaro_log_latency_reset(cobaro_loghandle_t lh)
+{
+    if (lh->histograms) {
+        memset(lh->histograms, 0,
+               COBARO_LOG_LATENCIES_COUNT * sizeof(*lh->histograms));
+    }
+}
+
  cobaro_log_t cobaro_log_next(cobaro_loghandle_t lh)
  {
-     int ret;
      cobaro_log_t log = NULL;
 
-     if ((ret = pthread_spin_lock(&lh->lock))) {
-         fprintf(stderr, "spin_lock failed %d\n", ret);
-     }
+     cobaro_log_lock_acquire(&lh->lock);
 
      if (lh->busy) {
          log = lh->busy;
          lh->busy = lh->busy->next;
+         lh->depth--;
+     } else if (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) {
+         // Take turns between the CPUs' queues.
+         for (uint16_t i = 0; !log && i < lh->pools_count; i++) {
+             uint16_t cpu = (lh->drain + i) % lh->pools_count;
+             struct cobaro_log_pool *pool = &lh->pools[cpu];
+
+             if ((log = cobaro_log_cpu_dequeue(pool))) {
+                 lh->drain = (cpu + 1) % lh->pools_count;
+                 lh->depth_max = MAX(lh->depth_max,
+                                     pool->enqueue - pool->dequeue + 1);
+             }
+         }
      }
 
-     if ((ret = pthread_spin_unlock(&lh->lock))) {
-         fprintf(stderr, "spin_unlock failed %d\n", ret);
+     cobaro_log_lock_release(&lh->lock);
+
+     if (log && log->published && lh->histograms) {
+         lh->dequeued = log;
+         lh->dequeued_at = cobaro_log_now_ns();
+         cobaro_log_latency_record(lh, COBARO_LOG_LATENCY_QUEUE,
+                                   lh->dequeued_at - log->published);
      }
 
      return log;
@@ -239,113 +1970,626 @@ void cobaro_log_set_ipv4(cobaro_log_t log, int argnum, uint32_t ipv4)
 
  void cobaro_log_return(cobaro_loghandle_t lh, cobaro_log_t log)
  {
-     int ret;
+     struct cobaro_log_pool *pool = cobaro_log_pool_of(lh, log);
 
-     if ((ret = pthread_spin_lock(&lh->lock))) {
-         fprintf(stderr, "spin_lock failed %d\n", ret);
+     // Not one of ours, so not ours to keep.
+     if (!pool) {
+         return;
      }
 
-     log->next = lh->free;
-     lh->free = log;
-
-     if ((ret = pthread_spin_unlock(&lh->lock))) {
-         fprintf(stderr, "spin_unlock failed %d\n", ret);
+     if (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) {
+         cobaro_log_cpu_give(pool, log);
+         return;
      }
 
+     cobaro_log_lock_acquire(&pool->lock);
+
+     log->next = pool->free;
+     pool->free = log;
+
+     cobaro_log_lock_release(&pool->lock);
+
  }
 
  bool cobaro_log_loglevel_set(cobaro_loghandle_t lh, int level)
  {
+     struct cobaro_log_config *config;
+
      if (level < LOG_EMERG || level > LOG_DEBUG) {
          return false;
      }
 
-     lh->level = level;
+     if (!(config = cobaro_log_config_change(lh))) {
+         return false;
+     }
+     config->level = level;
+
+     // Carry the new level into the filter, leaving disabled codes be.
+     struct cobaro_log_filter *filter = lh->filter;
+     for (uint32_t code = 0; code < filter->count; code++) {
+         if (filter->threshold[code] >= 0) {
+             filter->threshold[code] = level;
+         }
+     }
+     cobaro_log_config_publish(lh, config);
      return true;
  }
 
-int cobaro_log_to_file(cobaro_loghandle_t lh, cobaro_log_t log, FILE *f)
- {
-     char s[COBARO_LOG_FORMAT_MAX];
-     size_t formatted = 0;
-     struct timeval now = {0, 0};
-     static const char *time_failure = "--:--:--.------";
-
-     errno = 0;
+// Note the sampling rate after a formatted message, if it was sampled.
+// Only logs claimed from the handle say whether they were.
+static size_t cobaro_log_sample_note(cobaro_loghandle_t lh, cobaro_log_t log,
+                                     char *s, size_t s_len)
+{
+    if (log->sample <= 1 || !cobaro_log_pool_of(lh, log)) {
+        return 0;
+    }
+    return snprintf(s, s_len, " [sampled 1/%"PRIu32"]", log->sample);
+}
 
-     // loglevel test
-     if (log->level > lh->level) {
-         return 0;
-     }
+// Start file output with time (hh:mm:ss.mmmuuu) and a space.
+static size_t cobaro_log_timestamp(char *s, size_t s_len)
+{
+    size_t formatted = 0;
+    struct timeval now = {0, 0};
+    static const char *time_failure = "--:--:--.------";
 
-    // Start trace output with time (hh:mm:ss.mmmuuu).
     gettimeofday(&now, NULL);
-    formatted = strftime(s, sizeof(s), "%T", localtime(&now.tv_sec));
+    formatted = strftime(s, s_len, "%T", localtime(&now.tv_sec));
     if (!formatted) {
         formatted = snprintf(s, strlen(time_failure) + 1, "%s", time_failure);
     }
-    formatted += snprintf(&s[formatted], sizeof(s) - formatted,
+    formatted += snprintf(&s[formatted], s_len - formatted,
                           ".%06"PRI_SUSECONDS" ", now.tv_usec);
-    formatted += cobaro_log_to_string(lh, log, &s[formatted], sizeof(s) - formatted);
+    return formatted;
+}
+
+// Write library-generated text to every destination, subject to the
+// handle's level.
+static void cobaro_log_emit(cobaro_loghandle_t lh, int level, const char *text)
+{
+    struct cobaro_log_thread *reader;
+    const struct cobaro_log_config *config =
+        cobaro_log_config_enter(lh, &reader);
+    char s[COBARO_LOG_FORMAT_MAX];
+
+    if (level <= config->level) {
+        (void) cobaro_log_timestamp(s, sizeof(s));
+        for (int i = 0; i < config->sinks_count; i++) {
+            switch (config->sinks[i].logto) {
+            case COBARO_LOGTO_SYSLOG:
+                syslog(level, "%s", text);
+                break;
+            case COBARO_LOGTO_FILE:
+                fprintf(config->sinks[i].f, "%s%s\n", s, text);
+                break;
+            }
+        }
+    }
+    cobaro_log_config_leave(lh, reader);
+}
+
+// Format log with language, noting any sampling.  Returns the size
+// needed, including the NUL, as cobaro_log_to_string() does.
+static size_t cobaro_log_render(cobaro_loghandle_t lh,
+                                const struct cobaro_log_language *language,
+                                cobaro_log_t log, char *s, size_t s_len)
+{
+    size_t formatted = cobaro_log_format(language, log, s, s_len);
+
+    if (formatted <= s_len) {
+        formatted += cobaro_log_sample_note(lh, log, &s[formatted - 1],
+                                            s_len - formatted + 1);
+    }
+    return formatted;
+}
 
-    if (formatted > COBARO_LOG_FORMAT_MAX) {
+// Write text, of size as returned by cobaro_log_render(), to f after
+// stamp.  Returns as fprintf(), or -1 with errno set to ENOSPC if the
+// line would be longer than we allow.
+static int cobaro_log_file_line(cobaro_loghandle_t lh, FILE *f,
+                                const char *stamp, const char *text,
+                                size_t size)
+{
+    int ret;
+
+    if (strlen(stamp) + size > COBARO_LOG_FORMAT_MAX) {
+        COBARO_LOG_COUNT(lh, sink_errors, 1);
         errno = ENOSPC;
         return -1;
     }
 
-    return fprintf(f, "%s\n", s);
- }
+    if ((ret = fprintf(f, "%s%s\n", stamp, text)) < 0) {
+        COBARO_LOG_COUNT(lh, sink_errors, 1);
+    } else {
+        COBARO_LOG_COUNT(lh, bytes_written, ret);
+    }
+    return ret;
+}
+
+// Send text to syslog at log's level.
+static void cobaro_log_syslog_line(cobaro_loghandle_t lh, cobaro_log_t log,
+                                   const char *text)
+{
+    syslog(log->level, "%s", text);
+    COBARO_LOG_COUNT(lh, bytes_written, strlen(text));
+}
+
+// Count log as written.
+static void cobaro_log_written(cobaro_loghandle_t lh, cobaro_log_t log)
+{
+    COBARO_LOG_COUNT(lh, emitted[COBARO_LOG_LEVEL_INDEX(log->level)], 1);
+    cobaro_log_latency_written(lh, log);
+}
+
+// Write log to every sink, formatting it once for each language in use
+// rather than for each sink.  Returns false if a sink failed.
+static bool cobaro_log_sinks_write(cobaro_loghandle_t lh,
+                                   const struct cobaro_log_config *config,
+                                   cobaro_log_t log)
+{
+    char text[COBARO_LOG_SINKS_MAX][COBARO_LOG_FORMAT_MAX];
+    const struct cobaro_log_language *languages[COBARO_LOG_SINKS_MAX];
+    size_t sizes[COBARO_LOG_SINKS_MAX];
+    int languages_count = 0;
+    char stamp[64] = ""; // time, see cobaro_log_timestamp()
+    bool ok = true, written = false;
+
+    for (int i = 0; i < config->sinks_count; i++) {
+        const struct cobaro_log_sink *sink = &config->sinks[i];
+        const struct cobaro_log_language *language =
+            cobaro_log_sink_language(config, sink);
+        int k;
+
+        for (k = 0; k < languages_count; k++) {
+            if (languages[k]->messages == language->messages &&
+                languages[k]->catalog == language->catalog) {
+                break;
+            }
+        }
+        if (k == languages_count) {
+            languages[k] = language;
+            sizes[k] = cobaro_log_render(lh, language, log, text[k],
+                                         sizeof(text[k]));
+            languages_count++;
+        }
+
+        switch (sink->logto) {
+        case COBARO_LOGTO_SYSLOG:
+            cobaro_log_syslog_line(lh, log, text[k]);
+            written = true;
+            break;
+        case COBARO_LOGTO_FILE:
+            if (!stamp[0]) {
+                (void) cobaro_log_timestamp(stamp, sizeof(stamp));
+            }
+            if (cobaro_log_file_line(lh, sink->f, stamp, text[k],
+                                     sizes[k]) < 0) {
+                ok = false;
+            } else {
+                written = true;
+            }
+            break;
+        }
+    }
+
+    if (written) {
+        cobaro_log_written(lh, log);
+    }
+    return ok;
+}
+
+void cobaro_log_rate_limit_report(cobaro_loghandle_t lh)
+{
+    struct cobaro_log_filter_block *block;
+    char s[COBARO_LOG_FORMAT_MAX];
+
+    lh->rate_report = cobaro_log_now_ns() + COBARO_LOG_RATE_REPORT_NS;
+
+    block = COBARO_LOG_FILTER_BLOCK(lh);
+    for (uint32_t code = 0; code < block->filter.count; code++) {
+        if (!block->policy[code]) {
+            continue;
+        }
+        for (int i = 0; i <= COBARO_LOG_LEVELS_COUNT; i++) {
+            struct cobaro_log_bucket *b = &block->policy[code]->bucket[i];
+            uint32_t suppressed;
+
+            if (!b->suppressed) {
+                continue;
+            }
+            suppressed = __sync_lock_test_and_set(&b->suppressed, 0);
+            if (i == COBARO_LOG_LEVELS_COUNT) {
+                snprintf(s, sizeof(s), "rate limit suppressed %"PRIu32
+                         " messages with code %"PRIu32, suppressed, code);
+            } else {
+                snprintf(s, sizeof(s), "rate limit suppressed %"PRIu32
+                         " messages with code %"PRIu32" at level %d",
+                         suppressed, code, i);
+            }
+            cobaro_log_emit(lh, LOG_WARNING, s);
+        }
+    }
+}
+
+int cobaro_log_to_file(cobaro_loghandle_t lh, cobaro_log_t log, FILE *f)
+{
+    struct cobaro_log_thread *reader;
+    const struct cobaro_log_config *config =
+        cobaro_log_config_enter(lh, &reader);
+    char stamp[64], text[COBARO_LOG_FORMAT_MAX];
+    size_t size;
+    int ret = 0;
+
+    errno = 0;
+
+    // loglevel test
+    if (log->level > config->level) {
+        COBARO_LOG_COUNT(lh, filtered[COBARO_LOG_LEVEL_INDEX(log->level)], 1);
+    } else {
+        (void) cobaro_log_timestamp(stamp, sizeof(stamp));
+        size = cobaro_log_render(lh, &config->language, log, text,
+                                 sizeof(text));
+        if ((ret = cobaro_log_file_line(lh, f, stamp, text, size)) >= 0) {
+            cobaro_log_written(lh, log);
+        }
+    }
+    cobaro_log_config_leave(lh, reader);
+    return ret;
+}
+
+void cobaro_log_stats(cobaro_loghandle_t lh, struct cobaro_log_stats *stats)
+{
+    struct cobaro_log_thread *thread = &lh->stray;
+
+    memset(stats, 0, sizeof(*stats));
+    for (; thread; thread = thread == &lh->stray ? lh->threads : thread->next) {
+        struct cobaro_log_stats *slot = &thread->s;
+
+        stats->claims += slot->claims;
+        stats->claim_failures += slot->claim_failures;
+        stats->publishes += slot->publishes;
+        for (int level = 0; level < COBARO_LOG_LEVELS_COUNT; level++) {
+            stats->emitted[level] += slot->emitted[level];
+            stats->filtered[level] += slot->filtered[level];
+        }
+        stats->sampled_out += slot->sampled_out;
+        stats->rate_limited += slot->rate_limited;
+        stats->coalesced += slot->coalesced;
+        stats->bytes_written += slot->bytes_written;
+        stats->sink_errors += slot->sink_errors;
+    }
+
+    cobaro_log_lock_acquire(&lh->lock);
+    stats->queue_depth = lh->depth;
+    if (lh->pool_flags & COBARO_LOG_POOL_PER_CPU) {
+        for (uint16_t i = 0; i < lh->pools_count; i++) {
+            stats->queue_depth += lh->pools[i].enqueue - lh->pools[i].dequeue;
+        }
+    }
+    stats->queue_depth_max = lh->depth_max;
+    cobaro_log_lock_release(&lh->lock);
+}
+
+// Add a sink, after removing the others if replace is set.
+static bool cobaro_log_sink_add(cobaro_loghandle_t lh, bool replace,
+                                int logto, FILE *f, char **messages)
+{
+    struct cobaro_log_config *config;
+    struct cobaro_log_sink *sink;
+
+    if (!(config = cobaro_log_config_change(lh))) {
+        return false;
+    }
+    if (replace) {
+        while (config->sinks_count) {
+            sink = &config->sinks[--config->sinks_count];
+            if (sink->own) {
+                cobaro_log_codes_release(sink->language.codes);
+            }
+        }
+    }
+    if (config->sinks_count == COBARO_LOG_SINKS_MAX) {
+        cobaro_log_config_abandon(lh, config);
+        return false;
+    }
+
+    sink = &config->sinks[config->sinks_count];
+    memset(sink, 0, sizeof(*sink));
+    if (messages) {
+        if (!cobaro_log_language_set(&sink->language, messages, NULL)) {
+            cobaro_log_config_abandon(lh, config);
+            return false;
+        }
+        sink->own = true;
+    }
+    sink->logto = logto;
+    sink->f = f;
+    config->sinks_count++;
+    cobaro_log_config_publish(lh, config);
+    return true;
+}
 
 bool cobaro_log_file_set(cobaro_loghandle_t lh, FILE *f)
  {
-     lh->f = f;
-     lh->logto = COBARO_LOGTO_FILE;
-
-     return true;
+     return cobaro_log_sink_add(lh, true, COBARO_LOGTO_FILE, f, NULL);
  }    
 
  bool cobaro_log_syslog_set(cobaro_loghandle_t lh)
  {
-     lh->logto = COBARO_LOGTO_SYSLOG;
-
-     return true;
+     return cobaro_log_sink_add(lh, true, COBARO_LOGTO_SYSLOG, NULL, NULL);
  }    
 
-bool cobaro_log(cobaro_loghandle_t lh, cobaro_log_t log)
+bool cobaro_log_file_add(cobaro_loghandle_t lh, FILE *f, char **messages)
+{
+    return cobaro_log_sink_add(lh, false, COBARO_LOGTO_FILE, f, messages);
+}
+
+bool cobaro_log_syslog_add(cobaro_loghandle_t lh, char **messages)
+{
+    return cobaro_log_sink_add(lh, false, COBARO_LOGTO_SYSLOG, NULL, messages);
+}
+
+bool cobaro_log_coalesce_set(cobaro_loghandle_t lh, unsigned int window_ms)
+{
+    cobaro_log_flush(lh);
+    lh->have_last = false;
+    lh->coalesce = (uint64_t)window_ms * (COBARO_LOG_NS / 1000);
+    return true;
+}
+
+// FNV-1a over the parts of a log that affect its formatted text.
+static uint64_t cobaro_log_hash(cobaro_log_t log, uint32_t used)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const uint8_t *bytes;
+    size_t len;
+
+#define COBARO_LOG_HASH(data, size)                          \
+    for (bytes = (const uint8_t *)(data), len = (size);      \
+         len; len--) {                                       \
+        hash = (hash ^ *bytes++) * 1099511628211ull;         \
+    }
+
+    COBARO_LOG_HASH(&log->code, sizeof(log->code));
+    COBARO_LOG_HASH(&log->level, sizeof(log->level));
+    for (int i = 0; i < COBARO_LOG_PARAM_MAX; i++) {
+        if (!(used & (1u << i))) {
+            continue;
+        }
+        COBARO_LOG_HASH(&log->p[i].type, sizeof(log->p[i].type));
+        if (log->p[i].type == COBARO_STRING) {
+            COBARO_LOG_HASH(log->p[i].v.s, strnlen(log->p[i].v.s,
+                                                   sizeof(log->p[i].v.s)));
+        } else if (log->p[i].type == COBARO_IPV6) {
+            COBARO_LOG_HASH(log->p[i].v.ipv6, sizeof(log->p[i].v.ipv6));
+        } else if (log->p[i].type == COBARO_STATIC_STRING ||
+                   log->p[i].type == COBARO_LONG_STRING) {
+            COBARO_LOG_HASH(log->p[i].v.ss.s, log->p[i].v.ss.len);
+        } else {
+            COBARO_LOG_HASH(&log->p[i].v.i, sizeof(log->p[i].v.i));
+        }
+    }
+#undef COBARO_LOG_HASH
+
+    return hash;
+}
+
+// Whether two logs would format identically.
+static bool cobaro_log_same(cobaro_log_t a, cobaro_log_t b, uint32_t used)
+{
+    if (a->code != b->code || a->level != b->level) {
+        return false;
+    }
+    for (int i = 0; i < COBARO_LOG_PARAM_MAX; i++) {
+        if (!(used & (1u << i))) {
+            continue;
+        }
+        if (a->p[i].type != b->p[i].type) {
+            return false;
+        }
+        if (a->p[i].type == COBARO_STRING) {
+            if (strncmp(a->p[i].v.s, b->p[i].v.s, sizeof(a->p[i].v.s))) {
+                return false;
+            }
+        } else if (a->p[i].type == COBARO_IPV6) {
+            if (memcmp(a->p[i].v.ipv6, b->p[i].v.ipv6, sizeof(a->p[i].v.ipv6))) {
+                return false;
+            }
+        } else if (a->p[i].type == COBARO_STATIC_STRING ||
+                   a->p[i].type == COBARO_LONG_STRING) {
+            if (a->p[i].v.ss.len != b->p[i].v.ss.len ||
+                memcmp(a->p[i].v.ss.s, b->p[i].v.ss.s, a->p[i].v.ss.len)) {
+                return false;
+            }
+        } else if (a->p[i].v.i != b->p[i].v.i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Report how often the last message was repeated, if it was.
+static void cobaro_log_repeats_flush(cobaro_loghandle_t lh)
+{
+    char s[COBARO_LOG_FORMAT_MAX];
+
+    if (lh->repeats) {
+        snprintf(s, sizeof(s), "last message repeated %"PRIu32
+                 " times over %.3f s", lh->repeats,
+                 (double)(lh->last_repeat - lh->last_time) / COBARO_LOG_NS);
+        cobaro_log_emit(lh, lh->last.level, s);
+        lh->repeats = 0;
+    }
+}
+
+// Swallow log if it repeats the last message within the window.
+static bool cobaro_log_coalesced(cobaro_loghandle_t lh,
+                                 const struct cobaro_log_config *config,
+                                 cobaro_log_t log, uint64_t now)
 {
-    switch (lh->logto) {
-    case COBARO_LOGTO_SYSLOG:
-        cobaro_log_to_syslog(lh, log);
+    const struct cobaro_log_code *code;
+    uint32_t used = 0;
+    uint64_t hash;
+
+    // A repeat must be one in every language written.
+    if ((code = cobaro_log_language_code(&config->language, log->code))) {
+        used = code->info.used;
+    }
+    for (int i = 0; i < config->sinks_count; i++) {
+        if (config->sinks[i].own &&
+            (code = cobaro_log_language_code(&config->sinks[i].language,
+                                             log->code))) {
+            used |= code->info.used;
+        }
+    }
+
+    // Long strings live in the log's arena region, which is reused once
+    // the log is returned, so a copy of such a log can't be compared.
+    for (int i = 0; i < COBARO_LOG_PARAM_MAX; i++) {
+        if ((used & (1u << i)) && log->p[i].type == COBARO_LONG_STRING) {
+            cobaro_log_repeats_flush(lh);
+            lh->have_last = false;
+            return false;
+        }
+    }
+
+    hash = cobaro_log_hash(log, used);
+    if (lh->have_last && hash == lh->last_hash &&
+        now - lh->last_time < lh->coalesce &&
+        cobaro_log_same(&lh->last, log, used)) {
+        lh->repeats++;
+        lh->last_repeat = now;
         return true;
-    case COBARO_LOGTO_FILE:
-        return (cobaro_log_to_file(lh, log, lh->f) >= 0);
     }
 
+    cobaro_log_repeats_flush(lh);
+    memcpy(&lh->last, log, sizeof(lh->last));
+    lh->last_hash = hash;
+    lh->last_time = now;
+    lh->have_last = true;
     return false;
 }
 
+void cobaro_log_flush(cobaro_loghandle_t lh)
+{
+    cobaro_log_repeats_flush(lh);
+    cobaro_log_rate_limit_report(lh);
+}
+
+bool cobaro_log(cobaro_loghandle_t lh, cobaro_log_t log)
+{
+    const struct cobaro_log_config *config;
+    struct cobaro_log_thread *reader;
+    uint64_t now = cobaro_log_now_ns();
+    bool ret = true;
+
+    if (now >= lh->rate_report) {
+        cobaro_log_rate_limit_report(lh);
+    }
+
+    // One configuration for the whole message, even if it's replaced
+    // meanwhile.
+    config = cobaro_log_config_enter(lh, &reader);
+    if (log->level > config->level) {
+        COBARO_LOG_COUNT(lh, filtered[COBARO_LOG_LEVEL_INDEX(log->level)], 1);
+    } else if (lh->coalesce && cobaro_log_coalesced(lh, config, log, now)) {
+        COBARO_LOG_COUNT(lh, coalesced, 1);
+    } else {
+        ret = cobaro_log_sinks_write(lh, config, log);
+    }
+    cobaro_log_config_leave(lh, reader);
+
+    return ret;
+}
+
 void cobaro_log_to_syslog(cobaro_loghandle_t lh, cobaro_log_t log)
- {
-     char s[COBARO_LOG_FORMAT_MAX];
+{
+    struct cobaro_log_thread *reader;
+    const struct cobaro_log_config *config =
+        cobaro_log_config_enter(lh, &reader);
+    char text[COBARO_LOG_FORMAT_MAX];
+
+    // loglevel test
+    if (log->level > config->level) {
+        COBARO_LOG_COUNT(lh, filtered[COBARO_LOG_LEVEL_INDEX(log->level)], 1);
+    } else {
+        (void) cobaro_log_render(lh, &config->language, log, text,
+                                 sizeof(text));
+        cobaro_log_syslog_line(lh, log, text);
+        cobaro_log_written(lh, log);
+    }
+    cobaro_log_config_leave(lh, reader);
+}
 
-     // loglevel test
-     if (log->level <= lh->level) {
-         (void) cobaro_log_to_string(lh, log, s, sizeof(s));
-         syslog(log->level, "%s", s);
-     }
-     return;
- }
+// Append to s, of which written bytes are used (or would have been,
+// had there been space).  Returns how many bytes could be written.
+static size_t cobaro_log_append(char *s, size_t s_len, size_t written,
+                                const char *format, ...)
+{
+    size_t room = written < s_len ? s_len - written : 0;
+    va_list args;
+    int ret;
 
-int cobaro_log_to_string(cobaro_loghandle_t lh, cobaro_log_t log,
-                          char *s, size_t s_len)
+    va_start(args, format);
+    ret = vsnprintf(room ? &s[written] : NULL, room, format, args);
+    va_end(args);
+
+    return ret > 0 ? (size_t)ret : 0;
+}
+
+// Append a duration, in the largest unit that leaves a whole part.
+static size_t cobaro_log_append_duration(char *s, size_t s_len,
+                                         size_t written, int64_t ns)
+{
+    static const struct {
+        int64_t scale;
+        const char *unit;
+    } units[] = {
+        { 1000000000, "s" }, { 1000000, "ms" }, { 1000, "us" }
+    };
+    int64_t magnitude = ns < 0 ? -ns : ns;
+
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if (magnitude >= units[i].scale) {
+            return cobaro_log_append(s, s_len, written, "%g%s",
+                                     (double)ns / units[i].scale,
+                                     units[i].unit);
+        }
+    }
+    return cobaro_log_append(s, s_len, written, "%"PRIi64"ns", ns);
+}
+
+// Append a timestamp as ISO 8601 UTC, to the nanosecond.
+static size_t cobaro_log_append_timestamp(char *s, size_t s_len,
+                                          size_t written, uint64_t ns)
+{
+    time_t seconds = (time_t)(ns / COBARO_LOG_NS);
+    char date[32];
+    struct tm tm;
+
+    if (!gmtime_r(&seconds, &tm) ||
+        !strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm)) {
+        return cobaro_log_append(s, s_len, written, "%"PRIu64"ns", ns);
+    }
+    return cobaro_log_append(s, s_len, written, "%s.%09uZ", date,
+                             (unsigned int)(ns % COBARO_LOG_NS));
+}
+
+// Format log with language; see cobaro_log_to_string().
+static int cobaro_log_format(const struct cobaro_log_language *language,
+                             cobaro_log_t log, char *s, size_t s_len)
 {
     size_t written = 0; // How many _could_ be written
-    char *format_i18n;
+    const char *format_i18n;
     int arg;
-    char addr[INET_ADDRSTRLEN];
-
-    if (!(format_i18n = lh->messages[log->code])) {
-        return false;
+    char addr[INET6_ADDRSTRLEN];
+
+    // A code from a corrupt or newer record still says what it was.
+    if (!cobaro_log_language_code(language, log->code) ||
+        !(format_i18n = cobaro_log_language_template(language, log->code))) {
+        written = cobaro_log_append(s, s_len, 0, COBARO_LOG_UNKNOWN,
+                                    log->code);
+        return written + 1;
     }
 
     while (*format_i18n) {
@@ -353,30 +2597,68 @@ int cobaro_log_to_string(cobaro_loghandle_t lh, cobaro_log_t log,
 
             format_i18n++; // move along
 
-            // We have 8 arguments max: PARAM_MAX_FIX
-            if (*format_i18n > '0' && *format_i18n < '9') {
+            // We have COBARO_LOG_PARAM_MAX arguments max
+            if (*format_i18n > '0' &&
+                *format_i18n <= '0' + COBARO_LOG_PARAM_MAX) {
                 arg = *format_i18n - '1'; // args count from 1
                 format_i18n++; // move along
 
                 switch (log->p[arg].type) {
                 case COBARO_STRING:
-                    written += snprintf(&s[written], MAX(s_len - written, 0),
-                                        "%s", log->p[arg].v.s);
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "%s", log->p[arg].v.s);
                     break;
                 case COBARO_INTEGER:
-                    written += snprintf(&s[written], MAX(s_len - written, 0),
-                                        "%"PRIi64, log->p[arg].v.i);
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "%"PRIi64, log->p[arg].v.i);
                     break;
                 case COBARO_REAL:
-                    written += snprintf(&s[written], MAX(s_len - written, 0),
-                                        "%g", log->p[arg].v.f);
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "%g", log->p[arg].v.f);
                     break;
                 case COBARO_IPV4:
                     inet_ntop(AF_INET, &log->p[arg].v.ipv4,
                               addr, sizeof(addr));
 
-                    written += snprintf(&s[written], MAX(s_len - written, 0),
-                                        "%s", addr); 
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "%s", addr);
+                    break;
+                case COBARO_UINT64:
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "%"PRIu64, log->p[arg].v.u);
+                    break;
+                case COBARO_HEX:
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "0x%"PRIx64, log->p[arg].v.u);
+                    break;
+                case COBARO_BOOL:
+                    written += cobaro_log_append(s, s_len, written, "%s",
+                                                 log->p[arg].v.u ? "true" : "false");
+                    break;
+                case COBARO_IPV6:
+                    inet_ntop(AF_INET6, log->p[arg].v.ipv6,
+                              addr, sizeof(addr));
+
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "%s", addr);
+                    break;
+                case COBARO_POINTER:
+                    written += cobaro_log_append(s, s_len, written,
+                                                 "0x%"PRIx64, log->p[arg].v.u);
+                    break;
+                case COBARO_DURATION_NS:
+                    written += cobaro_log_append_duration(s, s_len, written,
+                                                          log->p[arg].v.i);
+                    break;
+                case COBARO_TIMESTAMP:
+                    written += cobaro_log_append_timestamp(s, s_len, written,
+                                                           log->p[arg].v.u);
+                    break;
+                case COBARO_STATIC_STRING:
+                case COBARO_LONG_STRING:
+                    written += cobaro_log_append(s, s_len, written, "%.*s",
+                                                 (int)log->p[arg].v.ss.len,
+                                                 log->p[arg].v.ss.s);
                     break;
                 }
             } else {
@@ -411,3 +2693,41 @@ int cobaro_log_to_string(cobaro_loghandle_t lh, cobaro_log_t log,
     return written;
 }
 
+bool cobaro_log_code_info(cobaro_loghandle_t lh, uint32_t code,
+                          struct cobaro_log_code_info *info)
+{
+    const struct cobaro_log_code *described;
+    struct cobaro_log_thread *reader;
+
+    described = cobaro_log_language_code(
+        &cobaro_log_config_enter(lh, &reader)->language, code);
+    if (described) {
+        memcpy(info, &described->info, sizeof(*info));
+    }
+    cobaro_log_config_leave(lh, reader);
+    return described != NULL;
+}
+
+size_t cobaro_log_string_size(cobaro_loghandle_t lh, cobaro_log_t log)
+{
+    struct cobaro_log_thread *reader;
+    size_t size;
+
+    size = cobaro_log_language_size(
+        &cobaro_log_config_enter(lh, &reader)->language, log);
+    cobaro_log_config_leave(lh, reader);
+    return size;
+}
+
+int cobaro_log_to_string(cobaro_loghandle_t lh, cobaro_log_t log,
+                          char *s, size_t s_len)
+{
+    struct cobaro_log_thread *reader;
+    int written;
+
+    written = cobaro_log_format(
+        &cobaro_log_config_enter(lh, &reader)->language, log, s, s_len);
+    cobaro_log_config_leave(lh, reader);
+    return written;
+}
+
@@ -7,82 +7,120 @@
 // All rights reserved.
 // COPYRIGHT_END
 
-// This code is a very lightly modified version of that posted by
-// Majek Majkowski at https://idea.popcount.org/
-// 2012-09-12-reinventing-spinlocks/ and also available at GitHub
-// https://github.com/majek/dump/blob/master/msqueue/
-// pthread_spin_lock_shim.h
-
-#include <errno.h>
-
-#define UNUSED(x) (void)x;
-
-typedef int pthread_spinlock_t;
-
-
-#ifndef PTHREAD_PROCESS_SHARED
-# define PTHREAD_PROCESS_SHARED (1)
+// Locks for the handle's free and busy lists.  These are held for a
+// handful of instructions, so waiters spin rather than sleep, but
+// they spin politely: they read the lock until it looks free before
+// trying to take it, so that the cache line is shared rather than
+// bounced between waiters, and they pause between reads, so that an
+// SMT sibling holding the lock isn't starved of issue slots.  They
+// never yield: a waiter that gave up its CPU would hold up everyone
+// behind it once the lock came its way.
+//
+// Two kinds are provided (see cobaro_log_locks in log.h):
+//
+//   test-and-test-and-set: cheapest when uncontended, but unfair, so
+//   a busy producer can starve others.  Waiters back off
+//   exponentially, up to a cap.
+//
+//   ticket: waiters are served in arrival order, at the cost of a
+//   second atomic counter.  Each waiter pauses in proportion to the
+//   number of tickets ahead of it, and the next in line polls, so it
+//   takes the lock as soon as it's passed on.
+
+#include <stdint.h>
+
+#define COBARO_LOG_BACKOFF_MAX (1024) // Most pauses between reads
+#define COBARO_LOG_TICKET_PAUSES (64) // Pauses per ticket ahead of ours
+
+#if defined(__i386__) || defined(__x86_64__)
+#  define COBARO_LOG_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#  define COBARO_LOG_PAUSE() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#  define COBARO_LOG_PAUSE() __asm__ __volatile__ ("" ::: "memory")
 #endif
 
-#ifndef PTHREAD_PROCESS_PRIVATE
-# define PTHREAD_PROCESS_PRIVATE (2)
-#endif
-
-
-static inline int
-pthread_spin_init(
-    pthread_spinlock_t *lock,
-    int pshared)
-{
-    UNUSED(pshared);
-	__asm__ __volatile__ ("" ::: "memory");
-	*lock = 0;
-	return 0;
-}
+struct cobaro_log_lock {
+    int kind;                 // from cobaro_log_locks
+    volatile uint32_t held;   // test-and-test-and-set: non-zero if held
+    volatile uint32_t next;   // ticket: next ticket to be issued
+    volatile uint32_t owner;  // ticket: ticket now holding the lock
+};
 
 
-static inline int
-pthread_spin_destroy(
-    pthread_spinlock_t *lock)
+static inline void
+cobaro_log_lock_init(
+    struct cobaro_log_lock *lock,
+    int kind)
 {
-    UNUSED(lock);
-	return 0;
+    lock->kind = kind;
+    lock->held = 0;
+    lock->next = 0;
+    lock->owner = 0;
+    __sync_synchronize();
 }
 
 
-static inline int
-pthread_spin_lock(
-    pthread_spinlock_t *lock)
+// Wait a little, and a little longer the next time, up to a limit.
+static inline void
+cobaro_log_backoff(
+    uint32_t *backoff)
 {
-	while (1) {
-		for (int i = 0; i < 10000; i++) {
-			if (__sync_bool_compare_and_swap(lock, 0, 1)) {
-				return 0;
-			}
-		}
-		sched_yield();
-	}
+    for (uint32_t i = 0; i < *backoff; i++) {
+        COBARO_LOG_PAUSE();
+    }
+    if (*backoff < COBARO_LOG_BACKOFF_MAX) {
+        *backoff <<= 1;
+    }
 }
 
 
-static inline int
-pthread_spin_trylock(
-    pthread_spinlock_t *lock)
+static inline void
+cobaro_log_lock_acquire(
+    struct cobaro_log_lock *lock)
 {
-	if (__sync_bool_compare_and_swap(lock, 0, 1)) {
-		return 0;
-	}
-	return EBUSY;
+    uint32_t backoff = 1;
+
+    if (lock->kind == COBARO_LOG_LOCK_TICKET) {
+        uint32_t ticket = __sync_fetch_and_add(&lock->next, 1);
+        uint32_t ahead;
+
+        // Each holder ahead of us takes about as long as any other, so
+        // wait out those beyond the first, then poll.
+        while ((ahead = ticket - lock->owner) > 1) {
+            uint32_t pauses = (ahead - 1) * COBARO_LOG_TICKET_PAUSES;
+
+            for (uint32_t i = 0; i < pauses; i++) {
+                COBARO_LOG_PAUSE();
+            }
+        }
+        while (lock->owner != ticket) {
+            COBARO_LOG_PAUSE();
+        }
+        __sync_synchronize();
+        return;
+    }
+
+    while (__sync_lock_test_and_set(&lock->held, 1)) {
+        while (lock->held) {
+            cobaro_log_backoff(&backoff);
+        }
+    }
 }
 
 
-static inline int
-pthread_spin_unlock(
-    pthread_spinlock_t *lock)
+static inline void
+cobaro_log_lock_release(
+    struct cobaro_log_lock *lock)
 {
-	__asm__ __volatile__ ("" ::: "memory");
-	*lock = 0;
-	return 0;
+    if (lock->kind == COBARO_LOG_LOCK_TICKET) {
+        // Only the holder writes owner, so no atomic add is needed.
+        __sync_synchronize();
+        lock->owner = lock->owner + 1;
+        return;
+    }
+
+    __sync_lock_release(&lock->held);
 }
 
 
@@ -260,7 +260,8 @@ typedef enum {
 #define GREATEST_RUN_TEST(TEST)                                         \
     do {                                                                \
         if (greatest_pre_test(#TEST) == 1) {                            \
-            greatest_test_res res = greatest_save_context();            \
+            greatest_test_res res =                                     \
+                (greatest_test_res)greatest_save_context();             \
             if (res == GREATEST_TEST_RES_PASS) {                        \
                 res = TEST();                                           \
             }                                                           \
@@ -438,14 +439,14 @@ typedef enum {
 
 #if GREATEST_USE_LONGJMP
 #define GREATEST_MAIN_DEFS_SAVE_CONTEXT()                               \
-    greatest_test_res greatest_save_context(void) {                     \
+    int greatest_save_context(void) {                                   \
         /* setjmp returns 0 (GREATEST_TEST_RES_PASS) on first call */   \
         /* so the test runs, then RES_FAIL from FAIL_WITH_LONGJMP. */   \
-        return (greatest_test_res)(setjmp(greatest_info.jump_dest));    \
+        return setjmp(greatest_info.jump_dest);                         \
     }
 #else
 #define GREATEST_MAIN_DEFS_SAVE_CONTEXT()                               \
-    greatest_test_res greatest_save_context(void) {                     \
+    int greatest_save_context(void) {                                   \
         /*a no-op, since setjmp/longjmp aren't being used */            \
         return GREATEST_TEST_RES_PASS;                                  \
     }
@@ -0,0 +1,166 @@
+// -*- mode: c++ -*-
+/****************************************************************
+COPYRIGHT_BEGIN
+Copyright (C) 2015, cobaro.org
+All rights reserved.
+COPYRIGHT_END
+****************************************************************/
+
+// Tests for the C++ interface.  The checks that reject bad catalogs
+// and calls are compile-time, so only the accepting side is tested
+// here; see the static_asserts below for the parser.
+
+#include "config.h"
+#include "libcobaro-log0/log.hpp"
+#include "greatest.h"
+
+#if defined(HAVE_ARPA_INET_H)
+# include <arpa/inet.h>
+#endif
+
+enum cobaro_test_cpp_message_ids {
+    COBARO_TEST_CPP_MESSAGE_NONE = 0,
+    COBARO_TEST_CPP_MESSAGE_CONNECTED,
+    COBARO_TEST_CPP_MESSAGE_TIMING,
+
+    COBARO_TEST_CPP_MSG_COUNT
+};
+
+namespace cobaro {
+template <> struct message<COBARO_TEST_CPP_MESSAGE_NONE>
+    : signature<> {};
+template <> struct message<COBARO_TEST_CPP_MESSAGE_CONNECTED>
+    : signature<const char *, std::uint16_t, ipv4> {};
+template <> struct message<COBARO_TEST_CPP_MESSAGE_TIMING>
+    : signature<static_string, std::chrono::nanoseconds, bool> {};
+}
+
+constexpr auto cobaro_test_cpp_en = cobaro::make_catalog(
+    // COBARO_TEST_CPP_MESSAGE_NONE
+    "nothing to see",
+
+    // COBARO_TEST_CPP_MESSAGE_CONNECTED
+    "%1 connected from %3 port %2",
+
+    // COBARO_TEST_CPP_MESSAGE_TIMING
+    "%1 took %2, 100%% %3");
+
+constexpr auto cobaro_test_cpp_klingon = cobaro::make_catalog(
+    // COBARO_TEST_CPP_MESSAGE_NONE
+    "pagh",
+
+    // COBARO_TEST_CPP_MESSAGE_CONNECTED
+    "%3:%2 %1 %1",
+
+    // COBARO_TEST_CPP_MESSAGE_TIMING
+    "%3 %2 %1");
+
+static_assert(cobaro_test_cpp_en.size() == COBARO_TEST_CPP_MSG_COUNT,
+              "catalog covers every code");
+static_assert(cobaro::detail::params_used("") == 0, "no parameters");
+static_assert(cobaro::detail::params_used("%2 %% %2") == 2, "repeats");
+static_assert(cobaro::detail::params_used("%3%1") == 5, "adjacent");
+
+cobaro_loghandle_t lh;
+
+static void setup_cb(void *data)
+{
+    (void)data;
+    lh = cobaro_log_init(cobaro_test_cpp_en.messages());
+}
+
+static void teardown_cb(void *data)
+{
+    (void)data;
+    cobaro_log_fini(lh);
+}
+
+GREATEST_TEST test_cpp_log() {
+    cobaro_log_t log;
+    char dest[256] = "";
+    std::uint16_t port = 8080;
+
+    // No parameters
+    GREATEST_ASSERT(cobaro::log<COBARO_TEST_CPP_MESSAGE_NONE>(
+                        lh, COBARO_LOG_INFO));
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_TEST_CPP_MESSAGE_NONE == log->code);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("nothing to see", dest);
+    cobaro_log_return(lh, log);
+
+    // Each parameter set by its declared type
+    GREATEST_ASSERT(cobaro::log<COBARO_TEST_CPP_MESSAGE_CONNECTED>(
+                        lh, COBARO_LOG_WARNING, "host", port,
+                        cobaro::ipv4(htonl(0x0a000001))));
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_LOG_WARNING == log->level);
+    GREATEST_ASSERT(COBARO_STRING == log->p[0].type);
+    GREATEST_ASSERT(COBARO_UINT64 == log->p[1].type);
+    GREATEST_ASSERT(COBARO_IPV4 == log->p[2].type);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("host connected from 10.0.0.1 port 8080", dest);
+    cobaro_log_return(lh, log);
+
+    // Arguments convert to the declared type
+    GREATEST_ASSERT(cobaro::log<COBARO_TEST_CPP_MESSAGE_TIMING>(
+                        lh, COBARO_LOG_INFO, "phase",
+                        std::chrono::microseconds(1500), true));
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_STATIC_STRING == log->p[0].type);
+    GREATEST_ASSERT(COBARO_DURATION_NS == log->p[1].type);
+    GREATEST_ASSERT(1500000 == log->p[1].v.i);
+    GREATEST_ASSERT(COBARO_BOOL == log->p[2].type);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("phase took 1.5ms, 100% true", dest);
+    cobaro_log_return(lh, log);
+
+    // Filtered
+    GREATEST_ASSERT(!cobaro::log<COBARO_TEST_CPP_MESSAGE_NONE>(
+                        lh, COBARO_LOG_DEBUG));
+    GREATEST_ASSERT(NULL == cobaro_log_next(lh));
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_cpp_catalog() {
+    cobaro_log_t log;
+    char dest[256] = "";
+
+    cobaro_log_messages_set(lh, cobaro_test_cpp_klingon.messages());
+
+    GREATEST_ASSERT(cobaro::log<COBARO_TEST_CPP_MESSAGE_CONNECTED>(
+                        lh, COBARO_LOG_INFO, "host", 80,
+                        cobaro::ipv4(htonl(0x7f000001))));
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("127.0.0.1:80 host host", dest);
+    cobaro_log_return(lh, log);
+
+    GREATEST_PASS();
+}
+
+GREATEST_SUITE(cpp_suite) {
+    GREATEST_SET_SETUP_CB(setup_cb, NULL);
+    GREATEST_SET_TEARDOWN_CB(teardown_cb, NULL);
+
+    GREATEST_RUN_TEST(test_cpp_log);
+    GREATEST_RUN_TEST(test_cpp_catalog);
+}
+
+/* Add definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    GREATEST_MAIN_BEGIN();      /* init & parse command-line args */
+    GREATEST_RUN_SUITE(cpp_suite);
+    GREATEST_MAIN_END();        /* display results */
+}
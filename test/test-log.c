@@ -13,11 +13,26 @@ COPYRIGHT_END
 # define _XOPEN_SOURCE 700
 #endif
 
+// Compile out DEBUG call sites, for test_compile_level
+#define COBARO_LOG_COMPILE_LEVEL COBARO_LOG_INFO
+
 #include "config.h"
 #include "libcobaro-log0/log.h"
 #include "greatest.h"
 #include "messages.h"
 
+#if defined(HAVE_ARPA_INET_H)
+# include <arpa/inet.h>
+#endif
+
+#if defined(HAVE_ERRNO_H)
+# include <errno.h>
+#endif
+
+#if defined(HAVE_MATH_H)
+# include <math.h>
+#endif
+
 #if defined(HAVE_PTHREAD_H)
 # include <pthread.h>
 #endif
@@ -96,7 +111,8 @@ void *producer_main(void *rock)
 GREATEST_TEST log_size() {
     struct cobaro_log log;
     
-    GREATEST_ASSERT(512 == sizeof(log));
+    GREATEST_ASSERT(COBARO_LOG_RECORD_SIZE == sizeof(log));
+    GREATEST_ASSERT(cobaro_log_record_size() == sizeof(log));
 
     GREATEST_PASS();
 }
@@ -122,6 +138,72 @@ GREATEST_TEST test_set_string() {
     GREATEST_PASS();
 }
 
+GREATEST_TEST test_set_static_string() {
+    struct cobaro_log log;
+    const char *name = "subsystem.function";
+    char dest[256] = "";
+
+    log.code = COBARO_TEST_MESSAGE_NULL;
+    log.level = COBARO_LOG_WARNING;
+    cobaro_log_set_literal(&log, 1, "abc");
+    GREATEST_ASSERT(COBARO_STATIC_STRING == log.p[0].type);
+
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("abc", dest);
+
+    // Only the given length is used
+    cobaro_log_set_static_string(&log, 1, name, 9);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("subsystem", dest);
+    GREATEST_PASS();
+}
+
+#define TEST_LONG "https://example.com/a/rather/long/path/that/would/not/fit?in=a&parameter=slot"
+
+GREATEST_TEST test_set_long_string() {
+    struct cobaro_log_options options;
+    cobaro_loghandle_t arena;
+    cobaro_log_t log;
+    char dest[256] = "";
+
+    // No arena: copied and truncated
+    log = cobaro_log_claim(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    log->code = COBARO_TEST_MESSAGE_NULL;
+    GREATEST_ASSERT(!cobaro_log_set_long_string(lh, log, 1, TEST_LONG));
+    GREATEST_ASSERT(COBARO_STRING == log->p[0].type);
+    cobaro_log_return(lh, log);
+
+    cobaro_log_options_init(&options);
+    options.arena = 100;
+    arena = cobaro_log_init_with(cobaro_messages_en, &options);
+    GREATEST_ASSERT_NOT_NULL(arena);
+
+    log = cobaro_log_claim(arena);
+    GREATEST_ASSERT_NOT_NULL(log);
+    log->code = COBARO_TEST_MESSAGE_NULL;
+    GREATEST_ASSERT(cobaro_log_set_long_string(arena, log, 1, TEST_LONG));
+    GREATEST_ASSERT(COBARO_LONG_STRING == log->p[0].type);
+    GREATEST_ASSERT(cobaro_log_to_string(arena, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ(TEST_LONG, dest);
+
+    // The rest of the region is too small for another
+    GREATEST_ASSERT(!cobaro_log_set_long_string(arena, log, 1, TEST_LONG));
+    GREATEST_ASSERT(cobaro_log_to_string(arena, log, dest, sizeof(dest)));
+    GREATEST_ASSERT(100 - strlen(TEST_LONG) == strlen(dest));
+    cobaro_log_return(arena, log);
+
+    // Until the log is claimed again
+    log = cobaro_log_claim(arena);
+    GREATEST_ASSERT_NOT_NULL(log);
+    log->code = COBARO_TEST_MESSAGE_NULL;
+    GREATEST_ASSERT(cobaro_log_set_long_string(arena, log, 1, TEST_LONG));
+    cobaro_log_return(arena, log);
+
+    cobaro_log_fini(arena);
+    GREATEST_PASS();
+}
+
 GREATEST_TEST test_set_integer() {
     struct cobaro_log log;
     char dest[256] = "";
@@ -161,6 +243,660 @@ GREATEST_TEST test_set_ipv4() {
     GREATEST_PASS();
 }
 
+GREATEST_TEST test_set_out_of_line() {
+    struct cobaro_log log;
+    void (*set_integer)(cobaro_log_t, int, int64_t) = cobaro_log_set_integer;
+    char dest[256] = "";
+
+    GREATEST_ASSERT(COBARO_LOG_ABI_VERSION == cobaro_log_abi_version());
+
+    // Without parentheses, the name is the library's function
+    log.code = COBARO_TEST_MESSAGE_NULL;
+    log.level = COBARO_LOG_WARNING;
+    set_integer(&log, 1, 42);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("42", dest);
+
+    // Out of range parameters are ignored, inline or not
+    set_integer(&log, COBARO_LOG_PARAM_MAX + 1, 1);
+    cobaro_log_set_integer(&log, 0, 1);
+    GREATEST_ASSERT(42 == log.p[0].v.i);
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_set_extended() {
+    struct cobaro_log log;
+    char dest[256] = "";
+    const uint8_t ipv6[16] = {
+        0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+    };
+
+    log.code = COBARO_TEST_MESSAGE_NULL;
+    log.level = COBARO_LOG_WARNING;
+
+    cobaro_log_set_uint64(&log, 1, UINT64_MAX);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("18446744073709551615", dest);
+
+    cobaro_log_set_hex(&log, 1, 0xdeadbeef);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("0xdeadbeef", dest);
+
+    cobaro_log_set_bool(&log, 1, true);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("true", dest);
+    cobaro_log_set_bool(&log, 1, false);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("false", dest);
+
+    cobaro_log_set_ipv6(&log, 1, ipv6);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("2001:db8::1", dest);
+
+    cobaro_log_set_pointer(&log, 1, (void *)0x1234);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("0x1234", dest);
+
+    cobaro_log_set_duration_ns(&log, 1, 999);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("999ns", dest);
+    cobaro_log_set_duration_ns(&log, 1, -2000);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("-2us", dest);
+    cobaro_log_set_duration_ns(&log, 1, 1500000);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("1.5ms", dest);
+    cobaro_log_set_duration_ns(&log, 1, 3000000000ll);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("3s", dest);
+
+    cobaro_log_set_timestamp(&log, 1, 1433160000123456789ull);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("2015-06-01T12:00:00.123456789Z", dest);
+
+    // Truncated, but still terminated
+    GREATEST_ASSERT(strlen("2015-06-01T12:00:00.123456789Z") + 1 ==
+                    cobaro_log_to_string(lh, &log, dest, 5));
+    GREATEST_ASSERT_STR_EQ("2015", dest);
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_claim_code() {
+    cobaro_log_t log;
+
+    // Default level is INFO
+    GREATEST_ASSERT(cobaro_log_enabled(lh, COBARO_TEST_MESSAGE_NULL,
+                                       COBARO_LOG_INFO));
+    GREATEST_ASSERT(!cobaro_log_enabled(lh, COBARO_TEST_MESSAGE_NULL,
+                                        COBARO_LOG_DEBUG));
+    GREATEST_ASSERT(!cobaro_log_enabled(lh, COBARO_TEST_MSG_COUNT,
+                                        COBARO_LOG_EMERG));
+
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES,
+                                COBARO_LOG_WARNING);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_TEST_MESSAGE_TYPES == log->code);
+    GREATEST_ASSERT(COBARO_LOG_WARNING == log->level);
+    cobaro_log_return(lh, log);
+
+    GREATEST_ASSERT(NULL == cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                                  COBARO_LOG_DEBUG));
+
+    // Disabled codes stay disabled across level changes
+    GREATEST_ASSERT(cobaro_log_code_enable(lh, COBARO_TEST_MESSAGE_NULL, false));
+    GREATEST_ASSERT(true == cobaro_log_loglevel_set(lh, LOG_DEBUG));
+    GREATEST_ASSERT(!cobaro_log_enabled(lh, COBARO_TEST_MESSAGE_NULL,
+                                        COBARO_LOG_EMERG));
+    GREATEST_ASSERT(cobaro_log_enabled(lh, COBARO_TEST_MESSAGE_TYPES,
+                                       COBARO_LOG_DEBUG));
+    GREATEST_ASSERT(NULL == cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                                  COBARO_LOG_EMERG));
+
+    GREATEST_ASSERT(cobaro_log_code_enable(lh, COBARO_TEST_MESSAGE_NULL, true));
+    GREATEST_ASSERT(cobaro_log_enabled(lh, COBARO_TEST_MESSAGE_NULL,
+                                       COBARO_LOG_DEBUG));
+    GREATEST_ASSERT(!cobaro_log_code_enable(lh, COBARO_TEST_MSG_COUNT, true));
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_compile_level() {
+    cobaro_log_t log;
+    int ran = 0;
+
+    GREATEST_ASSERT(true == cobaro_log_loglevel_set(lh, LOG_DEBUG));
+
+    COBARO_LOG_IF(lh, COBARO_LOG_DEBUG, COBARO_TEST_MESSAGE_NULL, debug) {
+        cobaro_log_set_string(debug, 1, "compiled out");
+        ran++;
+    }
+    GREATEST_ASSERT(0 == ran);
+    GREATEST_ASSERT(NULL == cobaro_log_next(lh));
+
+    COBARO_LOG_IF(lh, COBARO_LOG_INFO, COBARO_TEST_MESSAGE_NULL, info) {
+        cobaro_log_set_string(info, 1, "compiled in");
+        ran++;
+    }
+    GREATEST_ASSERT(1 == ran);
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_LOG_INFO == log->level);
+    GREATEST_ASSERT_STR_EQ("compiled in", log->p[0].v.s);
+    cobaro_log_return(lh, log);
+
+    // Filtered at runtime
+    GREATEST_ASSERT(true == cobaro_log_loglevel_set(lh, LOG_ERR));
+    COBARO_LOG_IF(lh, COBARO_LOG_INFO, COBARO_TEST_MESSAGE_NULL, info) {
+        ran++;
+    }
+    GREATEST_ASSERT(1 == ran);
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_generated_catalog() {
+    cobaro_log_t log;
+    char dest[256] = "";
+    const struct cobaro_log_message_info *info = cobaro_test_message_info;
+
+    // Per-message functions set each parameter by its declared type
+    GREATEST_ASSERT(cobaro_test_log_null(lh, "typed"));
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_TEST_MESSAGE_NULL == log->code);
+    GREATEST_ASSERT(COBARO_LOG_INFO == log->level);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("typed", dest);
+    cobaro_log_return(lh, log);
+
+#if COBARO_LOG_PARAM_MAX >= 4
+    GREATEST_ASSERT(cobaro_test_log_types(lh, "s", -1, 0.5, htonl(0x7f000001)));
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("s:s, i:-1, f:0.5, ip:127.0.0.1, percent:%", dest);
+    cobaro_log_return(lh, log);
+#else
+    // With fewer parameters than the message has, it has no setter, and
+    // a reference to a missing parameter is copied as plain text.
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES, COBARO_LOG_INFO);
+    GREATEST_ASSERT_NOT_NULL(log);
+    cobaro_log_set_string(log, 1, "s");
+    cobaro_log_set_integer(log, 2, -1);
+    cobaro_log_set_double(log, 3, 0.5);
+    cobaro_log_set_ipv4(log, 4, htonl(0x7f000001));
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("s:s, i:-1, f:0.5, ip:4, percent:%", dest);
+    cobaro_log_return(lh, log);
+#endif
+
+    // Filtered by level and code like any other claim
+    GREATEST_ASSERT(cobaro_log_code_enable(lh, COBARO_TEST_MESSAGE_NULL, false));
+    GREATEST_ASSERT(!cobaro_test_log_null(lh, "disabled"));
+    GREATEST_ASSERT(NULL == cobaro_log_next(lh));
+    GREATEST_ASSERT(cobaro_log_code_enable(lh, COBARO_TEST_MESSAGE_NULL, true));
+
+    // The definitions are recorded, by code
+    GREATEST_ASSERT_STR_EQ("NULL", info[COBARO_TEST_MESSAGE_NULL].name);
+    GREATEST_ASSERT(1 == info[COBARO_TEST_MESSAGE_NULL].count);
+    GREATEST_ASSERT(COBARO_STRING == info[COBARO_TEST_MESSAGE_NULL].types[0]);
+    GREATEST_ASSERT(COBARO_LOG_INFO == info[COBARO_TEST_MESSAGE_TYPES].level);
+    GREATEST_ASSERT(4 == info[COBARO_TEST_MESSAGE_TYPES].count);
+    GREATEST_ASSERT(COBARO_IPV4 == info[COBARO_TEST_MESSAGE_TYPES].types[3]);
+    GREATEST_ASSERT(NULL == info[COBARO_TEST_MSG_COUNT].name);
+
+    GREATEST_PASS();
+}
+
+// Built from messages.def by test/Makefile.am.
+#define BINARY_CATALOG "messages-klingon.cat"
+
+GREATEST_TEST test_binary_catalog() {
+    struct cobaro_log_options options;
+    struct cobaro_log_catalog *catalog;
+    struct cobaro_log_catalog_header header;
+    cobaro_loghandle_t loaded;
+    struct cobaro_log log;
+    char dest[256] = "";
+    FILE *f;
+
+    catalog = cobaro_log_catalog_open(BINARY_CATALOG);
+    GREATEST_ASSERT_NOT_NULL(catalog);
+    GREATEST_ASSERT(COBARO_TEST_MSG_COUNT == cobaro_log_catalog_count(catalog));
+    for (uint32_t code = 0; code < COBARO_TEST_MSG_COUNT; code++) {
+        GREATEST_ASSERT_STR_EQ(cobaro_messages_klingon[code],
+                               cobaro_log_catalog_template(catalog, code));
+    }
+    GREATEST_ASSERT(NULL == cobaro_log_catalog_template(
+                        catalog, COBARO_TEST_MSG_COUNT));
+
+    // Swapped in for the compiled catalog, and out again
+    GREATEST_ASSERT(cobaro_log_catalog_set(lh, catalog));
+    memset(&log, 0, sizeof(log));
+    log.code = COBARO_TEST_MESSAGE_NULL;
+    cobaro_log_set_string(&log, 1, "qapla'");
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("qapla'", dest);
+#if COBARO_LOG_PARAM_MAX >= 4
+    log.code = COBARO_TEST_MESSAGE_TYPES;
+    cobaro_log_set_integer(&log, 2, 7);
+    cobaro_log_set_double(&log, 3, 0.5);
+    cobaro_log_set_ipv4(&log, 4, htonl(0x7f000001));
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("i:7, s:qapla', hoch:qapla', f:0.5, "
+                           "ip:127.0.0.1, chipath:%", dest);
+#endif
+    log.code = COBARO_TEST_MSG_COUNT;
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("unknown code 2", dest);
+    cobaro_log_messages_set(lh, cobaro_messages_en);
+    cobaro_log_synchronize(lh);
+
+    // Or used from the start
+    cobaro_log_options_init(&options);
+    options.catalog = catalog;
+    loaded = cobaro_log_init_with(NULL, &options);
+    GREATEST_ASSERT_NOT_NULL(loaded);
+    GREATEST_ASSERT(cobaro_log_enabled(loaded, COBARO_TEST_MESSAGE_NULL,
+                                       COBARO_LOG_INFO));
+    log.code = COBARO_TEST_MESSAGE_NULL;
+    GREATEST_ASSERT(cobaro_log_to_string(loaded, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("qapla'", dest);
+    cobaro_log_fini(loaded);
+    cobaro_log_catalog_close(catalog);
+
+    // Files that aren't catalogs are refused
+    errno = 0;
+    GREATEST_ASSERT(NULL == cobaro_log_catalog_open("no-such.cat"));
+    GREATEST_ASSERT(ENOENT == errno);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COBARO_LOG_CATALOG_MAGIC, sizeof(header.magic));
+    header.version = COBARO_LOG_CATALOG_VERSION;
+    header.count = 1; // but no entry
+    header.size = sizeof(header);
+    f = fopen("bad.cat", "wb");
+    GREATEST_ASSERT_NOT_NULL(f);
+    GREATEST_ASSERT(1 == fwrite(&header, sizeof(header), 1, f));
+    fclose(f);
+    errno = 0;
+    GREATEST_ASSERT(NULL == cobaro_log_catalog_open("bad.cat"));
+    GREATEST_ASSERT(EINVAL == errno);
+    remove("bad.cat");
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_code_info() {
+    struct cobaro_log_code_info info;
+    struct cobaro_log log;
+    char dest[256], full[COBARO_LOG_STRING_MAX];
+    char *catalog[] = { "%1 and %1", "100%% %2", "" };
+    static const char text[] = "a static string longer than any other "
+                               "parameter could be, as it's not copied";
+
+    cobaro_log_messages_set(lh, catalog);
+
+    GREATEST_ASSERT(cobaro_log_code_info(lh, 0, &info));
+    GREATEST_ASSERT(1 == info.params);
+    GREATEST_ASSERT(1 == info.used);
+    GREATEST_ASSERT(cobaro_log_code_info(lh, 1, &info));
+    GREATEST_ASSERT(2 == info.params);
+    GREATEST_ASSERT(2 == info.used);
+    GREATEST_ASSERT(!cobaro_log_code_info(lh, 2, &info));
+
+    // The bound holds for the longest parameters
+    memset(&log, 0, sizeof(log));
+    log.code = 0;
+    memset(full, 'x', sizeof(full) - 1);
+    full[sizeof(full) - 1] = '\0';
+    cobaro_log_set_string(&log, 1, full);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)) <=
+                    (int)cobaro_log_string_size(lh, &log));
+    cobaro_log_code_info(lh, 0, &info);
+    GREATEST_ASSERT(cobaro_log_string_size(lh, &log) == info.length_max);
+
+    // Static strings add their own length
+    cobaro_log_set_static_string(&log, 1, text, sizeof(text) - 1);
+    GREATEST_ASSERT(2 * sizeof(text) + 4 <= cobaro_log_string_size(lh, &log));
+    GREATEST_ASSERT(2 * sizeof(text) + 4 ==
+                    cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+
+    // Codes outside the catalog are named, not looked up
+    log.code = 1000;
+    GREATEST_ASSERT(sizeof("unknown code 1000") ==
+                    cobaro_log_to_string(lh, &log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("unknown code 1000", dest);
+    GREATEST_ASSERT(sizeof("unknown code 1000") <=
+                    cobaro_log_string_size(lh, &log));
+    log.code = UINT32_MAX;
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, dest, sizeof(dest)) <=
+                    (int)cobaro_log_string_size(lh, &log));
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_log_macro() {
+#if !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L
+    GREATEST_SKIPm("needs C11");
+#else
+    cobaro_log_t log;
+    char dest[256] = "";
+    const char *name = "macro";
+    unsigned int count = 7;
+    bool flag = true; // the constant true is an int
+
+    GREATEST_ASSERT(true == cobaro_log_loglevel_set(lh, LOG_DEBUG));
+
+    // No parameters
+    COBARO_LOG(lh, COBARO_LOG_INFO, COBARO_TEST_MESSAGE_NULL);
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_TEST_MESSAGE_NULL == log->code);
+    GREATEST_ASSERT(COBARO_LOG_INFO == log->level);
+    cobaro_log_return(lh, log);
+
+    // One of each type
+    COBARO_LOG(lh, COBARO_LOG_WARNING, COBARO_TEST_MESSAGE_TYPES,
+               name, -42, 2.5, count, flag, (void *)0x10);
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(COBARO_LOG_WARNING == log->level);
+    GREATEST_ASSERT(COBARO_STRING == log->p[0].type);
+    GREATEST_ASSERT_STR_EQ("macro", log->p[0].v.s);
+    GREATEST_ASSERT(COBARO_INTEGER == log->p[1].type);
+    GREATEST_ASSERT(-42 == log->p[1].v.i);
+    GREATEST_ASSERT(COBARO_REAL == log->p[2].type);
+    if (COBARO_LOG_PARAM_MAX >= 6) {
+        GREATEST_ASSERT(COBARO_UINT64 == log->p[3].type);
+        GREATEST_ASSERT(7 == log->p[3].v.u);
+        GREATEST_ASSERT(COBARO_BOOL == log->p[4].type);
+        GREATEST_ASSERT(COBARO_POINTER == log->p[5].type);
+    }
+    cobaro_log_return(lh, log);
+
+    // String literals are copied
+    COBARO_LOG(lh, COBARO_LOG_INFO, COBARO_TEST_MESSAGE_NULL, "literal");
+    log = cobaro_log_next(lh);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(cobaro_log_to_string(lh, log, dest, sizeof(dest)));
+    GREATEST_ASSERT_STR_EQ("literal", dest);
+    cobaro_log_return(lh, log);
+
+    // Filtered: nothing is queued
+    COBARO_LOG(lh, COBARO_LOG_DEBUG, COBARO_TEST_MESSAGE_NULL, "compiled out");
+    GREATEST_ASSERT(NULL == cobaro_log_next(lh));
+    GREATEST_PASS();
+#endif
+}
+
+GREATEST_TEST test_rate_limit() {
+    cobaro_log_t log;
+    int claimed = 0;
+
+    // A burst of three, and then nothing for a second.
+    GREATEST_ASSERT(cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                              -1, 1.0, 3));
+    for (int i = 0; i < 10; i++) {
+        if ((log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                         COBARO_LOG_INFO))) {
+            cobaro_log_return(lh, log);
+            claimed++;
+        }
+    }
+    GREATEST_ASSERT(3 == claimed);
+
+    // Per-level limits are separate from other levels' ...
+    GREATEST_ASSERT(cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_TYPES,
+                                              COBARO_LOG_INFO, 1.0, 1));
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES, COBARO_LOG_INFO);
+    GREATEST_ASSERT_NOT_NULL(log);
+    cobaro_log_return(lh, log);
+    GREATEST_ASSERT(NULL == cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES,
+                                                  COBARO_LOG_INFO));
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES, COBARO_LOG_ERR);
+    GREATEST_ASSERT_NOT_NULL(log);
+    cobaro_log_return(lh, log);
+
+    // ... and can be removed
+    GREATEST_ASSERT(cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_TYPES,
+                                              COBARO_LOG_INFO, 0, 0));
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES, COBARO_LOG_INFO);
+    GREATEST_ASSERT_NOT_NULL(log);
+    cobaro_log_return(lh, log);
+
+    GREATEST_ASSERT(!cobaro_log_rate_limit_set(lh, COBARO_TEST_MSG_COUNT,
+                                               -1, 1.0, 1));
+    GREATEST_ASSERT(!cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                               COBARO_LOG_LEVELS_COUNT, 1.0, 1));
+    GREATEST_ASSERT(!cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                               -1, NAN, 1));
+    GREATEST_ASSERT(!cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                               -1, INFINITY, 1));
+
+    // A tiny rate is a long interval, not an overflow ...
+    GREATEST_ASSERT(cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_TYPES,
+                                              -1, 1e-300, 1));
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES, COBARO_LOG_ERR);
+    GREATEST_ASSERT_NOT_NULL(log);
+    cobaro_log_return(lh, log);
+    GREATEST_ASSERT(NULL == cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES,
+                                                  COBARO_LOG_ERR));
+
+    // ... and a huge burst of them doesn't wrap
+    GREATEST_ASSERT(cobaro_log_rate_limit_set(lh, COBARO_TEST_MESSAGE_TYPES,
+                                              -1, 1e-300, UINT32_MAX));
+    for (int i = 0; i < 10; i++) {
+        log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_TYPES,
+                                    COBARO_LOG_ERR);
+        GREATEST_ASSERT_NOT_NULL(log);
+        cobaro_log_return(lh, log);
+    }
+
+    // Summarize the suppressed messages
+    cobaro_log_rate_limit_report(lh);
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_sample() {
+    cobaro_log_t log;
+    int kept = 0;
+    char s[256];
+    FILE *f;
+
+    GREATEST_ASSERT(cobaro_log_sample_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                          COBARO_LOG_SAMPLE_EVERY, 4));
+    for (int i = 0; i < 16; i++) {
+        if ((log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                         COBARO_LOG_INFO))) {
+            GREATEST_ASSERT(4 == log->sample);
+            cobaro_log_return(lh, log);
+            kept++;
+        }
+    }
+    GREATEST_ASSERT(4 == kept);
+
+    // Reported with a note of the rate
+    f = tmpfile();
+    GREATEST_ASSERT_NOT_NULL(f);
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL, COBARO_LOG_INFO);
+    GREATEST_ASSERT_NOT_NULL(log);
+    cobaro_log_set_string(log, 1, "kept");
+    GREATEST_ASSERT(0 < cobaro_log_to_file(lh, log, f));
+    cobaro_log_return(lh, log);
+    rewind(f);
+    GREATEST_ASSERT_NOT_NULL(fgets(s, sizeof(s), f));
+    GREATEST_ASSERT(strstr(s, "kept [sampled 1/4]\n"));
+    fclose(f);
+
+    // Might straddle a second, but no more than once
+    kept = 0;
+    GREATEST_ASSERT(cobaro_log_sample_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                          COBARO_LOG_SAMPLE_FIRST, 2));
+    for (int i = 0; i < 16; i++) {
+        if ((log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                         COBARO_LOG_INFO))) {
+            cobaro_log_return(lh, log);
+            kept++;
+        }
+    }
+    GREATEST_ASSERT(kept >= 2 && kept <= 4);
+
+    GREATEST_ASSERT(cobaro_log_sample_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                          COBARO_LOG_SAMPLE_RATIO, 1));
+    log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL, COBARO_LOG_INFO);
+    GREATEST_ASSERT_NOT_NULL(log);
+    GREATEST_ASSERT(1 == log->sample);
+    cobaro_log_return(lh, log);
+
+    GREATEST_ASSERT(!cobaro_log_sample_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                           COBARO_LOG_SAMPLE_EVERY, 0));
+    GREATEST_ASSERT(!cobaro_log_sample_set(lh, COBARO_TEST_MSG_COUNT,
+                                           COBARO_LOG_SAMPLE_NONE, 0));
+
+    // Unsampled claims don't inherit a rate
+    GREATEST_ASSERT(cobaro_log_sample_set(lh, COBARO_TEST_MESSAGE_NULL,
+                                          COBARO_LOG_SAMPLE_EVERY, 1000));
+    for (int i = 0; i < 16; i++) {
+        log = cobaro_log_claim(lh);
+        GREATEST_ASSERT_NOT_NULL(log);
+        GREATEST_ASSERT(1 == log->sample);
+        cobaro_log_return(lh, log);
+    }
+
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_coalesce() {
+    struct cobaro_log log;
+    FILE *f = tmpfile();
+    char s[256];
+    int lines = 0;
+
+    GREATEST_ASSERT_NOT_NULL(f);
+    GREATEST_ASSERT(cobaro_log_file_set(lh, f));
+    GREATEST_ASSERT(cobaro_log_coalesce_set(lh, 60000));
+
+    memset(&log, 0, sizeof(log));
+    log.code = COBARO_TEST_MESSAGE_NULL;
+    log.level = COBARO_LOG_WARNING;
+    cobaro_log_set_string(&log, 1, "again");
+    // Unreferenced parameters don't make a message different
+    for (int i = 0; i < 5; i++) {
+        cobaro_log_set_integer(&log, 2, i);
+        GREATEST_ASSERT(cobaro_log(lh, &log));
+    }
+    cobaro_log_set_string(&log, 1, "different");
+    GREATEST_ASSERT(cobaro_log(lh, &log));
+    cobaro_log_flush(lh);
+
+    rewind(f);
+    while (fgets(s, sizeof(s), f)) {
+        lines++;
+        switch (lines) {
+        case 1:
+            GREATEST_ASSERT(strstr(s, " again\n"));
+            break;
+        case 2:
+            GREATEST_ASSERT(strstr(s, " last message repeated 4 times"));
+            break;
+        case 3:
+            GREATEST_ASSERT(strstr(s, " different\n"));
+            break;
+        }
+    }
+    GREATEST_ASSERT(3 == lines);
+
+    cobaro_log_file_set(lh, stdout);
+    fclose(f);
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_stats() {
+    struct cobaro_log_stats stats;
+    cobaro_log_t logs[32];
+    uint64_t claimed = 0;
+    FILE *f = tmpfile();
+
+    GREATEST_ASSERT_NOT_NULL(f);
+
+    // Exhaust the pool, and publish all of it
+    for (int i = 0; i < 32; i++) {
+        if ((logs[claimed] = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                                   COBARO_LOG_ERR))) {
+            cobaro_log_set_string(logs[claimed], 1, "counted");
+            cobaro_log_publish(lh, logs[claimed]);
+            claimed++;
+        }
+    }
+    GREATEST_ASSERT(NULL == cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                                  COBARO_LOG_DEBUG));
+
+    for (uint64_t i = 0; i < claimed; i++) {
+        cobaro_log_t log = cobaro_log_next(lh);
+        GREATEST_ASSERT_NOT_NULL(log);
+        GREATEST_ASSERT(0 < cobaro_log_to_file(lh, log, f));
+        cobaro_log_return(lh, log);
+    }
+
+    cobaro_log_stats(lh, &stats);
+    GREATEST_ASSERT(claimed == stats.claims);
+    GREATEST_ASSERT(32 - claimed == stats.claim_failures);
+    GREATEST_ASSERT(claimed == stats.publishes);
+    GREATEST_ASSERT(0 == stats.queue_depth);
+    GREATEST_ASSERT(claimed == stats.queue_depth_max);
+    GREATEST_ASSERT(claimed == stats.emitted[COBARO_LOG_ERR]);
+    GREATEST_ASSERT(1 == stats.filtered[COBARO_LOG_DEBUG]);
+    GREATEST_ASSERT((uint64_t)ftell(f) == stats.bytes_written);
+    GREATEST_ASSERT(0 == stats.sink_errors);
+
+    fclose(f);
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_latency() {
+    struct timespec ts = { 0, 100000 };
+    cobaro_log_t log;
+    FILE *f = tmpfile();
+
+    GREATEST_ASSERT_NOT_NULL(f);
+    GREATEST_ASSERT(0 == cobaro_log_latency_percentile(
+                        lh, COBARO_LOG_LATENCY_QUEUE, 50));
+    GREATEST_ASSERT(cobaro_log_latency_enable(lh, true));
+
+    for (int i = 0; i < 10; i++) {
+        log = cobaro_log_claim_code(lh, COBARO_TEST_MESSAGE_NULL,
+                                    COBARO_LOG_ERR);
+        GREATEST_ASSERT_NOT_NULL(log);
+        cobaro_log_set_string(log, 1, "timed");
+        cobaro_log_publish(lh, log);
+        (void)nanosleep(&ts, NULL);
+
+        log = cobaro_log_next(lh);
+        GREATEST_ASSERT_NOT_NULL(log);
+        GREATEST_ASSERT(0 < cobaro_log_to_file(lh, log, f));
+        cobaro_log_return(lh, log);
+    }
+
+    // We slept for 100us between publish and next
+    GREATEST_ASSERT(100000 <= cobaro_log_latency_percentile(
+                        lh, COBARO_LOG_LATENCY_QUEUE, 50));
+    GREATEST_ASSERT(cobaro_log_latency_percentile(
+                        lh, COBARO_LOG_LATENCY_QUEUE, 50) <=
+                    cobaro_log_latency_percentile(
+                        lh, COBARO_LOG_LATENCY_QUEUE, 100));
+    GREATEST_ASSERT(0 < cobaro_log_latency_percentile(
+                        lh, COBARO_LOG_LATENCY_WRITE, 99.9));
+
+    cobaro_log_latency_reset(lh);
+    GREATEST_ASSERT(0 == cobaro_log_latency_percentile(
+                        lh, COBARO_LOG_LATENCY_WRITE, 99.9));
+
+    fclose(f);
+    GREATEST_PASS();
+}
+
 GREATEST_TEST log_communication() {
     pthread_t thread[NUM_PRODUCERS + 1]; 
     pthread_attr_t attr;
@@ -188,6 +924,162 @@ GREATEST_TEST log_communication() {
     GREATEST_PASS();
 }
 
+// Catalogs for test_reconfigure, told apart by their output.
+static char *reconfigure_alpha[] = { "alpha %1", "" };
+static char *reconfigure_beta[] = { "beta %1 %1", "" };
+
+struct reconfigure_rock {
+    volatile bool done;
+    int reported;
+    int bad;
+};
+
+// Report one log repeatedly while the main thread reconfigures.
+void *reconfigure_main(void *rock)
+{
+    struct reconfigure_rock *r = (struct reconfigure_rock *)rock;
+    struct cobaro_log log;
+    char s[64];
+
+    memset(&log, 0, sizeof(log));
+    log.code = 0;
+    log.level = COBARO_LOG_ERR;
+    cobaro_log_set_string(&log, 1, "x");
+
+    while (!r->done || r->reported < SEND_COUNT) {
+        (void) cobaro_log_to_string(lh, &log, s, sizeof(s));
+        if (strcmp(s, "alpha x") && strcmp(s, "beta x x")) {
+            r->bad++;
+        }
+        if (!cobaro_log(lh, &log)) {
+            r->bad++;
+        }
+        r->reported++;
+    }
+    pthread_exit(rock);
+}
+
+GREATEST_TEST test_reconfigure() {
+    struct reconfigure_rock rock = { false, 0, 0 };
+    pthread_t thread;
+    void *retval;
+    FILE *f[2];
+    char s[64];
+    struct cobaro_log log;
+
+    cobaro_log_messages_set(lh, reconfigure_alpha);
+    f[0] = tmpfile();
+    f[1] = tmpfile();
+    GREATEST_ASSERT(f[0] && f[1]);
+    GREATEST_ASSERT(cobaro_log_file_set(lh, f[0]));
+
+    GREATEST_ASSERT(0 == pthread_create(&thread, NULL, reconfigure_main,
+                                        &rock));
+    for (int i = 0; i < SEND_COUNT; i++) {
+        cobaro_log_messages_set(lh, i % 2 ? reconfigure_alpha :
+                                reconfigure_beta);
+        GREATEST_ASSERT(cobaro_log_loglevel_set(lh, i % 3 ? LOG_INFO :
+                                                LOG_DEBUG));
+        GREATEST_ASSERT(cobaro_log_file_set(lh, f[i % 2]));
+
+        // Returns even though reporting never stops
+        if (i % 100 == 0) {
+            cobaro_log_synchronize(lh);
+        }
+    }
+    rock.done = true;
+    GREATEST_ASSERT(0 == pthread_join(thread, &retval));
+    GREATEST_ASSERT(0 == rock.bad);
+
+    // Nothing uses the old configurations now; the last one stands.
+    cobaro_log_synchronize(lh);
+    memset(&log, 0, sizeof(log));
+    cobaro_log_set_string(&log, 1, "y");
+    GREATEST_ASSERT(cobaro_log_to_string(lh, &log, s, sizeof(s)));
+    GREATEST_ASSERT_STR_EQ("alpha y", s);
+
+    GREATEST_ASSERT(cobaro_log_file_set(lh, stdout));
+    cobaro_log_synchronize(lh);
+    fclose(f[0]);
+    fclose(f[1]);
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_sinks() {
+    struct cobaro_log_stats stats;
+    struct cobaro_log log;
+    FILE *f[COBARO_LOG_SINKS_MAX];
+    char s[256];
+
+    for (int i = 0; i < COBARO_LOG_SINKS_MAX; i++) {
+        f[i] = tmpfile();
+        GREATEST_ASSERT_NOT_NULL(f[i]);
+    }
+
+    // One destination in the handle's language, two in another, and
+    // one following the handle's
+    cobaro_log_messages_set(lh, reconfigure_alpha);
+    GREATEST_ASSERT(cobaro_log_file_set(lh, f[0]));
+    GREATEST_ASSERT(cobaro_log_file_add(lh, f[1], reconfigure_beta));
+    GREATEST_ASSERT(cobaro_log_file_add(lh, f[2], reconfigure_beta));
+    GREATEST_ASSERT(cobaro_log_file_add(lh, f[3], NULL));
+    GREATEST_ASSERT(!cobaro_log_file_add(lh, stdout, NULL));
+
+    memset(&log, 0, sizeof(log));
+    log.code = 0;
+    log.level = COBARO_LOG_INFO;
+    cobaro_log_set_string(&log, 1, "x");
+    GREATEST_ASSERT(cobaro_log(lh, &log));
+
+    // And again once the handle's language changes
+    cobaro_log_messages_set(lh, reconfigure_beta);
+    GREATEST_ASSERT(cobaro_log(lh, &log));
+
+    for (int i = 0; i < COBARO_LOG_SINKS_MAX; i++) {
+        rewind(f[i]);
+        GREATEST_ASSERT(fgets(s, sizeof(s), f[i]));
+        GREATEST_ASSERT(strstr(s, i == 1 || i == 2 ? " beta x x\n" :
+                               " alpha x\n"));
+        GREATEST_ASSERT(fgets(s, sizeof(s), f[i]));
+        GREATEST_ASSERT(strstr(s, " beta x x\n"));
+        GREATEST_ASSERT(!fgets(s, sizeof(s), f[i]));
+    }
+
+    // Counted once however many destinations it went to
+    cobaro_log_stats(lh, &stats);
+    GREATEST_ASSERT(2 == stats.emitted[COBARO_LOG_INFO]);
+
+    // Setting a destination replaces them all
+    GREATEST_ASSERT(cobaro_log_file_set(lh, stdout));
+    cobaro_log_synchronize(lh);
+    for (int i = 0; i < COBARO_LOG_SINKS_MAX; i++) {
+        fclose(f[i]);
+    }
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_lock_ticket() {
+    struct cobaro_log_options options;
+    cobaro_loghandle_t ticket;
+
+    cobaro_log_options_init(&options);
+    GREATEST_ASSERT(sizeof(options) == options.size);
+    GREATEST_ASSERT(COBARO_LOG_LOCK_TTAS == options.lock);
+
+    options.lock = COBARO_LOG_LOCKS_COUNT;
+    GREATEST_ASSERT(NULL == cobaro_log_init_with(cobaro_messages_en, &options));
+
+    // Run the communication test again with a ticket lock
+    options.lock = COBARO_LOG_LOCK_TICKET;
+    ticket = cobaro_log_init_with(cobaro_messages_en, &options);
+    GREATEST_ASSERT_NOT_NULL(ticket);
+    cobaro_log_fini(lh);
+    lh = ticket;
+
+    GREATEST_CHECK_CALL(log_communication());
+    GREATEST_PASS();
+}
+
 
 #define TEST_OUT1 "string literal"
 #define TEST_EXPECT1 (strlen(TEST_OUT1) + 1)
@@ -195,8 +1087,12 @@ GREATEST_TEST log_communication() {
 #define TEST_EXPECT2 (strlen(TEST_OUT2) + 1)
 
 GREATEST_TEST log_messages() {
+#if COBARO_LOG_PARAM_MAX < 4
+    GREATEST_SKIPm("needs four parameters");
+#else
     struct cobaro_log log;
     char s[256];
+    FILE *f;
     
     log.code = COBARO_TEST_MESSAGE_NULL;
     log.level = COBARO_LOG_WARNING;
@@ -234,7 +1130,17 @@ GREATEST_TEST log_messages() {
     GREATEST_ASSERT(s[strlen(TEST_OUT2)] == '\0');
 
 
-    // Log that to file
+    // Log that to file, with no sampling note: whatever sample says,
+    // this log wasn't claimed, so wasn't sampled
+    log.sample = 7;
+    f = tmpfile();
+    GREATEST_ASSERT_NOT_NULL(f);
+    GREATEST_ASSERT(0 != cobaro_log_to_file(lh, &log, f));
+    rewind(f);
+    GREATEST_ASSERT_NOT_NULL(fgets(s, sizeof(s), f));
+    GREATEST_ASSERT(strstr(s, TEST_OUT2));
+    GREATEST_ASSERT(NULL == strstr(s, "[sampled"));
+    fclose(f);
     GREATEST_ASSERT(0 != cobaro_log_to_file(lh, &log, stdout));
 
     // Log to syslog
@@ -259,6 +1165,114 @@ GREATEST_TEST log_messages() {
     GREATEST_ASSERT(true == cobaro_log_loglevel_set(lh, LOG_CRIT));
     GREATEST_ASSERT(true == cobaro_log(lh, &log));
     
+    GREATEST_PASS();
+#endif
+}
+
+GREATEST_TEST test_pool_options() {
+    struct cobaro_log_options options;
+    cobaro_loghandle_t pooled;
+    struct cobaro_log stray;
+    cobaro_log_t log[16];
+    int claimed = 0, reclaimed = 0;
+    int flags = COBARO_LOG_POOL_HUGEPAGES | COBARO_LOG_POOL_MLOCK |
+        COBARO_LOG_POOL_NUMA;
+
+    cobaro_log_options_init(&options);
+    options.slots = 0;
+    GREATEST_ASSERT(NULL == cobaro_log_init_with(cobaro_messages_en, &options));
+    options.slots = 4;
+    options.pool = 16;
+    GREATEST_ASSERT(NULL == cobaro_log_init_with(cobaro_messages_en, &options));
+
+    // Whatever the platform allows, the pool must work
+    options.pool = flags;
+    pooled = cobaro_log_init_with(cobaro_messages_en, &options);
+    GREATEST_ASSERT_NOT_NULL(pooled);
+    GREATEST_ASSERT(0 == (cobaro_log_pool_flags(pooled) & ~flags));
+
+    // Slots are shared out between nodes rounding up, so there may be
+    // a few more than asked for, but never unlimited.
+    while (claimed < 16 && (log[claimed] = cobaro_log_claim(pooled))) {
+        claimed++;
+    }
+    GREATEST_ASSERT(claimed >= 4 && claimed < 16);
+    for (int i = 0; i < claimed; i++) {
+        cobaro_log_return(pooled, log[i]);
+    }
+    log[0] = cobaro_log_claim(pooled);
+    GREATEST_ASSERT_NOT_NULL(log[0]);
+    cobaro_log_return(pooled, log[0]);
+
+    // Logs that aren't the pool's are ignored, not added to it
+    stray.pool = 0;
+    cobaro_log_return(pooled, &stray);
+    stray.pool = UINT8_MAX;
+    cobaro_log_return(pooled, &stray);
+    while (reclaimed < 16 && (log[reclaimed] = cobaro_log_claim(pooled))) {
+        GREATEST_ASSERT(log[reclaimed] != &stray);
+        reclaimed++;
+    }
+    GREATEST_ASSERT(claimed == reclaimed);
+    for (int i = 0; i < reclaimed; i++) {
+        cobaro_log_return(pooled, log[i]);
+    }
+
+    cobaro_log_fini(pooled);
+    GREATEST_PASS();
+}
+
+GREATEST_TEST test_pool_per_cpu() {
+    struct cobaro_log_options options;
+    struct cobaro_log_stats stats;
+    cobaro_loghandle_t percpu;
+    struct cobaro_log stray;
+    cobaro_log_t log;
+    int claimed = 0, received = 0;
+
+    cobaro_log_options_init(&options);
+    options.slots = 4;
+    options.pool = COBARO_LOG_POOL_PER_CPU | COBARO_LOG_POOL_NUMA;
+    percpu = cobaro_log_init_with(cobaro_messages_en, &options);
+    GREATEST_ASSERT_NOT_NULL(percpu);
+    GREATEST_ASSERT(COBARO_LOG_POOL_PER_CPU == cobaro_log_pool_flags(percpu));
+
+    // Every CPU has all the slots, and a claim may take from any of
+    // them.  Publishing the lot from one CPU overflows its queue onto
+    // the shared one, and nothing is lost.
+    while ((log = cobaro_log_claim(percpu))) {
+        log->code = claimed++;
+        cobaro_log_publish(percpu, log);
+    }
+    GREATEST_ASSERT(claimed >= 4 && claimed % 4 == 0);
+    cobaro_log_stats(percpu, &stats);
+    GREATEST_ASSERT(claimed == (int)stats.queue_depth);
+    while ((log = cobaro_log_next(percpu))) {
+        cobaro_log_return(percpu, log);
+        received++;
+    }
+    GREATEST_ASSERT(claimed == received);
+    cobaro_log_stats(percpu, &stats);
+    GREATEST_ASSERT(0 == stats.queue_depth);
+
+    // Logs that aren't the pools' are ignored, not added to them
+    stray.pool = 0;
+    cobaro_log_return(percpu, &stray);
+    stray.pool = UINT8_MAX;
+    cobaro_log_return(percpu, &stray);
+    for (received = 0; (log = cobaro_log_claim(percpu)); received++) {
+        GREATEST_ASSERT(log != &stray);
+        cobaro_log_publish(percpu, log);
+    }
+    GREATEST_ASSERT(claimed == received);
+    while ((log = cobaro_log_next(percpu))) {
+        cobaro_log_return(percpu, log);
+    }
+
+    // And again with threads moving between CPUs
+    cobaro_log_fini(lh);
+    lh = percpu;
+    GREATEST_CHECK_CALL(log_communication());
     GREATEST_PASS();
 }
 
@@ -269,11 +1283,31 @@ GREATEST_SUITE(cobaro_test_log) {
     GREATEST_RUN_TEST(test_version);
     GREATEST_RUN_TEST(log_size);
     GREATEST_RUN_TEST(test_set_string);
+    GREATEST_RUN_TEST(test_set_static_string);
+    GREATEST_RUN_TEST(test_set_long_string);
     GREATEST_RUN_TEST(test_set_integer);
     GREATEST_RUN_TEST(test_set_double);
     GREATEST_RUN_TEST(test_set_ipv4);
+    GREATEST_RUN_TEST(test_set_extended);
+    GREATEST_RUN_TEST(test_set_out_of_line);
     GREATEST_RUN_TEST(log_messages);
+    GREATEST_RUN_TEST(test_claim_code);
+    GREATEST_RUN_TEST(test_compile_level);
+    GREATEST_RUN_TEST(test_generated_catalog);
+    GREATEST_RUN_TEST(test_binary_catalog);
+    GREATEST_RUN_TEST(test_code_info);
+    GREATEST_RUN_TEST(test_log_macro);
+    GREATEST_RUN_TEST(test_rate_limit);
+    GREATEST_RUN_TEST(test_sample);
+    GREATEST_RUN_TEST(test_coalesce);
+    GREATEST_RUN_TEST(test_stats);
+    GREATEST_RUN_TEST(test_latency);
     GREATEST_RUN_TEST(log_communication);
+    GREATEST_RUN_TEST(test_reconfigure);
+    GREATEST_RUN_TEST(test_sinks);
+    GREATEST_RUN_TEST(test_lock_ticket);
+    GREATEST_RUN_TEST(test_pool_options);
+    GREATEST_RUN_TEST(test_pool_per_cpu);
 }
 
 /* Add definitions that need to be in the test runner's main file. */
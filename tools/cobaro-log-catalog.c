@@ -0,0 +1,737 @@
+// -*- mode: c -*-
+/****************************************************************
+COPYRIGHT_BEGIN
+Copyright (C) 2015, cobaro.org
+All rights reserved.
+COPYRIGHT_END
+****************************************************************/
+
+// Generates a message catalog's C header and source from a message
+// definition file, so that the code enumeration, the catalog arrays
+// for each language and the parameter types can't drift apart.
+//
+//   cobaro-log-catalog definitions.def messages.h messages.c
+//
+// A definition file looks like this:
+//
+//   # Comments start with a hash.
+//   enum my_app                 # MY_APP_MESSAGE_*, my_app_log_*()
+//   catalog my_app_messages     # my_app_messages_en[], ...
+//   languages en fr
+//
+//   message CONNECTED info
+//       param host string
+//       param port uint64
+//       en connected to {host} port {port}
+//       fr connecté à {host} port {port}
+//
+// Each message has a level (emerg, alert, crit, err, warning, notice,
+// info or debug), up to nine parameters, and a template in every
+// language.  Templates name their parameters in braces, and must use
+// all of them; {{ is a literal brace, and % is a literal percent
+// sign.  Templates are compiled to the %n form that the library
+// reads, and checked, here rather than at runtime.
+//
+// The header has the code enumeration, the catalogs, a table of
+// cobaro_log_message_info by code, and for each message an inline
+// function that takes its parameters with their C types, eg.
+//
+//   bool my_app_log_connected(cobaro_loghandle_t lh,
+//                             const char *host, uint64_t port);
+//
+// which claims, sets and publishes as COBARO_LOG_IF() does, with no
+// type dispatch at runtime.
+//
+// With --binary, one language's catalog is written instead as a file
+// for cobaro_log_catalog_open(), so it can be added or changed without
+// rebuilding the program:
+//
+//   cobaro-log-catalog --binary definitions.def fr messages-fr.cat
+
+#include "config.h"
+#include "libcobaro-log0/log.h"
+
+#if defined(HAVE_STDARG_H)
+# include <stdarg.h>
+#endif
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_SIZE (4096) // Longest line in a definition file, plus one
+#define NAME_SIZE (64) // Longest identifier, plus one
+#define PARAMS_MAX (9) // Templates name parameters with one digit
+#define LANGUAGES_MAX (16)
+
+// How each parameter type is set.
+enum param_kinds {
+    KIND_PLAIN = 0, // set with (log, argnum, value)
+    KIND_STATIC, // set with (log, argnum, value, length)
+    KIND_LONG // set with (lh, log, argnum, value)
+};
+
+static const struct {
+    const char *name; // in definition files
+    const char *type; // from cobaro_log_types
+    const char *c_type; // of the logging function's argument
+    const char *setter;
+    int kind;
+} param_types[] = {
+    { "string", "COBARO_STRING", "const char *",
+      "cobaro_log_set_string_inline", KIND_PLAIN },
+    { "static_string", "COBARO_STATIC_STRING", "const char *",
+      "cobaro_log_set_static_string_inline", KIND_STATIC },
+    { "long_string", "COBARO_LONG_STRING", "const char *",
+      "cobaro_log_set_long_string", KIND_LONG },
+    { "integer", "COBARO_INTEGER", "int64_t",
+      "cobaro_log_set_integer_inline", KIND_PLAIN },
+    { "real", "COBARO_REAL", "double",
+      "cobaro_log_set_double_inline", KIND_PLAIN },
+    { "ipv4", "COBARO_IPV4", "uint32_t",
+      "cobaro_log_set_ipv4_inline", KIND_PLAIN },
+    { "uint64", "COBARO_UINT64", "uint64_t",
+      "cobaro_log_set_uint64_inline", KIND_PLAIN },
+    { "hex", "COBARO_HEX", "uint64_t",
+      "cobaro_log_set_hex_inline", KIND_PLAIN },
+    { "bool", "COBARO_BOOL", "bool",
+      "cobaro_log_set_bool_inline", KIND_PLAIN },
+    { "ipv6", "COBARO_IPV6", "const uint8_t *",
+      "cobaro_log_set_ipv6_inline", KIND_PLAIN },
+    { "pointer", "COBARO_POINTER", "const void *",
+      "cobaro_log_set_pointer_inline", KIND_PLAIN },
+    { "duration_ns", "COBARO_DURATION_NS", "int64_t",
+      "cobaro_log_set_duration_ns_inline", KIND_PLAIN },
+    { "timestamp", "COBARO_TIMESTAMP", "uint64_t",
+      "cobaro_log_set_timestamp_inline", KIND_PLAIN },
+};
+
+#define PARAM_TYPES_COUNT ((int)(sizeof(param_types) / sizeof(param_types[0])))
+
+// Indexed by cobaro_log_levels.
+static const char *level_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+#define LEVELS_COUNT ((int)(sizeof(level_names) / sizeof(level_names[0])))
+
+struct param {
+    char name[NAME_SIZE];
+    int type; // index into param_types
+};
+
+struct message {
+    char name[NAME_SIZE];
+    int level;
+    int line; // of its definition, for errors
+    int count; // of params
+    struct param params[PARAMS_MAX];
+    char *templates[LANGUAGES_MAX]; // compiled, by language
+};
+
+// The definition file being read.
+static const char *path;
+static int line;
+
+static char enum_name[NAME_SIZE];
+static char catalog_name[NAME_SIZE + sizeof("_messages")];
+static char languages[LANGUAGES_MAX][NAME_SIZE];
+static int languages_count;
+static struct message *messages;
+static int messages_count;
+
+
+// Report an error at the current line, and exit.
+static void fail(const char *format, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s:%d: ", path, line);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+// Copy the next whitespace-separated word from *s to word, and move
+// *s past it.  Returns false if there are no more words.
+static bool next_word(char **s, char *word, size_t size)
+{
+    size_t len;
+
+    while (isspace((unsigned char)**s)) {
+        (*s)++;
+    }
+    for (len = 0; (*s)[len] && !isspace((unsigned char)(*s)[len]); len++) {
+    }
+    if (!len) {
+        return false;
+    }
+    if (len >= size) {
+        fail("'%.*s' is too long", (int)len, *s);
+    }
+    memcpy(word, *s, len);
+    word[len] = '\0';
+    *s += len;
+    return true;
+}
+
+static void check_identifier(const char *word)
+{
+    if (!isalpha((unsigned char)*word) && *word != '_') {
+        fail("'%s' is not a C identifier", word);
+    }
+    for (const char *c = word; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') {
+            fail("'%s' is not a C identifier", word);
+        }
+    }
+}
+
+// Read one word that must be the last on the line.
+static void last_word(char **s, char *word, const char *what)
+{
+    char extra[NAME_SIZE];
+
+    if (!next_word(s, word, NAME_SIZE)) {
+        fail("missing %s", what);
+    }
+    if (next_word(s, extra, sizeof(extra))) {
+        fail("unexpected '%s' after %s", extra, what);
+    }
+}
+
+static struct message *current_message(const char *keyword)
+{
+    if (!messages_count) {
+        fail("'%s' before any message", keyword);
+    }
+    return &messages[messages_count - 1];
+}
+
+// Translate a template from named parameters to the library's %n
+// form, checking that it uses each parameter of the message.
+static char *compile_template(const struct message *m, const char *source)
+{
+    // Each source character becomes at most two.
+    char *compiled = malloc(2 * strlen(source) + 1);
+    char *out = compiled;
+    uint32_t used = 0;
+
+    if (!compiled) {
+        fail("out of memory");
+    }
+    while (*source) {
+        if (source[0] == '{' && source[1] == '{') {
+            *out++ = '{';
+            source += 2;
+        } else if (*source == '{') {
+            const char *end = strchr(source, '}');
+            int i;
+
+            if (!end) {
+                fail("unterminated '{' in template");
+            }
+            for (i = 0; i < m->count; i++) {
+                if (strlen(m->params[i].name) == (size_t)(end - source - 1) &&
+                    !strncmp(m->params[i].name, source + 1, end - source - 1)) {
+                    break;
+                }
+            }
+            if (i == m->count) {
+                fail("template refers to '%.*s', which is not a parameter "
+                     "of %s", (int)(end - source - 1), source + 1, m->name);
+            }
+            *out++ = '%';
+            *out++ = '1' + i;
+            used |= 1u << i;
+            source = end + 1;
+        } else if (*source == '%') {
+            *out++ = '%';
+            *out++ = '%';
+            source++;
+        } else {
+            *out++ = *source++;
+        }
+    }
+    *out = '\0';
+
+    for (int i = 0; i < m->count; i++) {
+        if (!(used & (1u << i))) {
+            fail("template does not use parameter '%s'", m->params[i].name);
+        }
+    }
+    return compiled;
+}
+
+static void parse_line(char *s)
+{
+    char word[NAME_SIZE], name[NAME_SIZE], kind[NAME_SIZE];
+    struct message *m;
+    int i;
+
+    if (!next_word(&s, word, sizeof(word)) || word[0] == '#') {
+        return;
+    }
+
+    if (!strcmp(word, "enum")) {
+        last_word(&s, enum_name, "enumeration prefix");
+        check_identifier(enum_name);
+
+    } else if (!strcmp(word, "catalog")) {
+        last_word(&s, catalog_name, "catalog prefix");
+        check_identifier(catalog_name);
+
+    } else if (!strcmp(word, "languages")) {
+        if (languages_count) {
+            fail("languages are already defined");
+        }
+        while (next_word(&s, name, sizeof(name))) {
+            if (languages_count == LANGUAGES_MAX) {
+                fail("more than %d languages", LANGUAGES_MAX);
+            }
+            check_identifier(name);
+            strcpy(languages[languages_count++], name);
+        }
+        if (!languages_count) {
+            fail("missing language names");
+        }
+
+    } else if (!strcmp(word, "message")) {
+        if (!next_word(&s, name, sizeof(name))) {
+            fail("missing message name");
+        }
+        check_identifier(name);
+        last_word(&s, kind, "message level");
+        for (i = 0; i < messages_count; i++) {
+            if (!strcmp(messages[i].name, name)) {
+                fail("message %s is already defined at line %d",
+                     name, messages[i].line);
+            }
+        }
+        if (!(m = realloc(messages, (messages_count + 1) * sizeof(*m)))) {
+            fail("out of memory");
+        }
+        messages = m;
+        m = &messages[messages_count++];
+        memset(m, 0, sizeof(*m));
+        strcpy(m->name, name);
+        m->line = line;
+        for (m->level = 0; m->level < LEVELS_COUNT; m->level++) {
+            if (!strcmp(kind, level_names[m->level])) {
+                break;
+            }
+        }
+        if (m->level == LEVELS_COUNT) {
+            fail("unknown level '%s'", kind);
+        }
+
+    } else if (!strcmp(word, "param")) {
+        m = current_message(word);
+        if (!next_word(&s, name, sizeof(name))) {
+            fail("missing parameter name");
+        }
+        check_identifier(name);
+        last_word(&s, kind, "parameter type");
+        for (i = 0; i < m->count; i++) {
+            if (!strcmp(m->params[i].name, name)) {
+                fail("%s already has a parameter '%s'", m->name, name);
+            }
+        }
+        for (i = 0; i < languages_count; i++) {
+            if (m->templates[i]) {
+                fail("parameters must come before templates");
+            }
+        }
+        if (m->count == PARAMS_MAX) {
+            fail("more than %d parameters", PARAMS_MAX);
+        }
+        for (i = 0; i < PARAM_TYPES_COUNT; i++) {
+            if (!strcmp(kind, param_types[i].name)) {
+                break;
+            }
+        }
+        if (i == PARAM_TYPES_COUNT) {
+            fail("unknown parameter type '%s'", kind);
+        }
+        strcpy(m->params[m->count].name, name);
+        m->params[m->count++].type = i;
+
+    } else {
+        for (i = 0; i < languages_count; i++) {
+            if (!strcmp(word, languages[i])) {
+                break;
+            }
+        }
+        if (i == languages_count) {
+            fail("unknown keyword or language '%s'", word);
+        }
+        m = current_message(word);
+        if (m->templates[i]) {
+            fail("%s already has a template in %s", m->name, word);
+        }
+        while (isspace((unsigned char)*s)) {
+            s++;
+        }
+        m->templates[i] = compile_template(m, s);
+    }
+}
+
+static void parse(FILE *f)
+{
+    char buf[LINE_SIZE];
+    size_t len;
+
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+        len = strlen(buf);
+        if (len == sizeof(buf) - 1 && buf[len - 1] != '\n') {
+            fail("line is longer than %d characters", LINE_SIZE - 2);
+        }
+        while (len && isspace((unsigned char)buf[len - 1])) {
+            buf[--len] = '\0';
+        }
+        parse_line(buf);
+    }
+
+    if (!enum_name[0]) {
+        fail("no enumeration prefix was given with 'enum'");
+    }
+    if (!languages_count) {
+        fail("no languages were given with 'languages'");
+    }
+    if (!catalog_name[0]) {
+        snprintf(catalog_name, sizeof(catalog_name), "%s_messages",
+                 enum_name);
+    }
+    for (int i = 0; i < messages_count; i++) {
+        for (int j = 0; j < languages_count; j++) {
+            if (!messages[i].templates[j]) {
+                line = messages[i].line;
+                fail("%s has no template in %s", messages[i].name,
+                     languages[j]);
+            }
+        }
+    }
+}
+
+// Write a name in upper or lower case.
+static void put_case(FILE *f, const char *name, bool upper)
+{
+    for (; *name; name++) {
+        fputc(upper ? toupper((unsigned char)*name) :
+              tolower((unsigned char)*name), f);
+    }
+}
+
+// Write a string as a C string literal.
+static void put_literal(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char)*s < ' ') {
+            fprintf(f, "\\%03o", (unsigned char)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Write MY_APP_MESSAGE_NAME.
+static void put_code(FILE *f, const struct message *m)
+{
+    put_case(f, enum_name, true);
+    fprintf(f, "_MESSAGE_%s", m->name);
+}
+
+static void put_level(FILE *f, int level)
+{
+    fprintf(f, "COBARO_LOG_");
+    put_case(f, level_names[level], true);
+}
+
+static void put_function(FILE *f, const struct message *m)
+{
+    const char *indent = "    ";
+
+    fprintf(f, "\n");
+    if (m->count > 3) {
+        // The smallest record profile has three parameters.
+        fprintf(f, "#if COBARO_LOG_PARAM_MAX >= %d\n", m->count);
+    }
+    fprintf(f, "/// Log ");
+    put_code(f, m);
+    fprintf(f, " at ");
+    put_level(f, m->level);
+    fprintf(f, ", if enabled.\n"
+            "static inline bool\n%s_log_", enum_name);
+    put_case(f, m->name, false);
+    fprintf(f, "(\n%scobaro_loghandle_t lh", indent);
+    for (int i = 0; i < m->count; i++) {
+        const char *c_type = param_types[m->params[i].type].c_type;
+
+        fprintf(f, ",\n%s%s%s%s", indent, c_type,
+                c_type[strlen(c_type) - 1] == '*' ? "" : " ",
+                m->params[i].name);
+        if (param_types[m->params[i].type].kind == KIND_STATIC) {
+            fprintf(f, ",\n%ssize_t %s_length", indent, m->params[i].name);
+        }
+    }
+    fprintf(f, ")\n{\n%scobaro_log_t log;\n\n", indent);
+
+    fprintf(f, "%sif (!COBARO_LOG_COMPILED(", indent);
+    put_level(f, m->level);
+    fprintf(f, ") ||\n%s    !COBARO_LOG_UNLIKELY(cobaro_log_enabled(\n"
+            "%s%s    lh, ", indent, indent, indent);
+    put_code(f, m);
+    fprintf(f, ", ");
+    put_level(f, m->level);
+    fprintf(f, "))) {\n%s%sreturn false;\n%s}\n", indent, indent, indent);
+
+    fprintf(f, "%sif (!(log = cobaro_log_claim_code(\n%s%s%s  lh, ",
+            indent, indent, indent, indent);
+    put_code(f, m);
+    fprintf(f, ", ");
+    put_level(f, m->level);
+    fprintf(f, "))) {\n%s%sreturn false;\n%s}\n", indent, indent, indent);
+
+    for (int i = 0; i < m->count; i++) {
+        const char *setter = param_types[m->params[i].type].setter;
+        const char *name = m->params[i].name;
+
+        switch (param_types[m->params[i].type].kind) {
+        case KIND_PLAIN:
+            fprintf(f, "%s%s(log, %d, %s);\n", indent, setter, i + 1, name);
+            break;
+        case KIND_STATIC:
+            fprintf(f, "%s%s(log, %d, %s, %s_length);\n",
+                    indent, setter, i + 1, name, name);
+            break;
+        case KIND_LONG:
+            fprintf(f, "%s(void)%s(lh, log, %d, %s);\n",
+                    indent, setter, i + 1, name);
+            break;
+        }
+    }
+    fprintf(f, "%scobaro_log_publish(lh, log);\n%sreturn true;\n}\n",
+            indent, indent);
+    if (m->count > 3) {
+        fprintf(f, "#endif\n");
+    }
+}
+
+static void put_header(FILE *f, const char *source)
+{
+    fprintf(f, "// -*- mode: c -*-\n"
+            "// Generated by cobaro-log-catalog from %s: do not edit.\n",
+            source);
+    fprintf(f, "#ifndef ");
+    put_case(f, enum_name, true);
+    fprintf(f, "_MESSAGES_H\n#define ");
+    put_case(f, enum_name, true);
+    fprintf(f, "_MESSAGES_H\n\n"
+            "#include \"libcobaro-log0/log.h\"\n\n"
+            "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+
+    fprintf(f, "/// Message codes.\nenum %s_message_ids {\n", enum_name);
+    for (int i = 0; i < messages_count; i++) {
+        fprintf(f, "    ");
+        put_code(f, &messages[i]);
+        fprintf(f, " = %d,\n", i);
+    }
+    fprintf(f, "\n    ");
+    put_case(f, enum_name, true);
+    fprintf(f, "_MSG_COUNT\n};\n\n");
+
+    fprintf(f, "/// Catalogs, for cobaro_log_init() and "
+            "cobaro_log_messages_set().\n");
+    for (int i = 0; i < languages_count; i++) {
+        fprintf(f, "extern char *%s_%s[];\n", catalog_name, languages[i]);
+    }
+
+    fprintf(f, "\n/// Level and parameter types of each message, by code.\n"
+            "extern const struct cobaro_log_message_info "
+            "%s_message_info[];\n", enum_name);
+
+    for (int i = 0; i < messages_count; i++) {
+        put_function(f, &messages[i]);
+    }
+
+    fprintf(f, "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n");
+}
+
+static void put_source(FILE *f, const char *source, const char *header)
+{
+    const char *base = strrchr(header, '/');
+
+    fprintf(f, "// -*- mode: c -*-\n"
+            "// Generated by cobaro-log-catalog from %s: do not edit.\n\n"
+            "#include \"%s\"\n", source, base ? base + 1 : header);
+
+    for (int j = 0; j < languages_count; j++) {
+        fprintf(f, "\nchar *%s_%s[", catalog_name, languages[j]);
+        put_case(f, enum_name, true);
+        fprintf(f, "_MSG_COUNT + 1] = {\n");
+        for (int i = 0; i < messages_count; i++) {
+            fprintf(f, "    // ");
+            put_code(f, &messages[i]);
+            fprintf(f, "\n    ");
+            put_literal(f, messages[i].templates[j]);
+            fprintf(f, ",\n\n");
+        }
+        fprintf(f, "    \"\"\n};\n");
+    }
+
+    fprintf(f, "\nconst struct cobaro_log_message_info %s_message_info[",
+            enum_name);
+    put_case(f, enum_name, true);
+    fprintf(f, "_MSG_COUNT + 1] = {\n");
+    for (int i = 0; i < messages_count; i++) {
+        fprintf(f, "    { \"%s\", ", messages[i].name);
+        put_level(f, messages[i].level);
+        fprintf(f, ", %d, {", messages[i].count);
+        for (int k = 0; k < messages[i].count; k++) {
+            fprintf(f, "%s %s", k ? "," : "",
+                    param_types[messages[i].params[k].type].type);
+        }
+        fprintf(f, " } },\n");
+    }
+    fprintf(f, "    { NULL, 0, 0, { 0 } }\n};\n");
+}
+
+// Write one output file, removing it if that fails.
+static bool write_file(const char *name, const char *source,
+                       const char *header, bool is_header)
+{
+    FILE *f = fopen(name, "w");
+    bool ok;
+
+    if (!f) {
+        perror(name);
+        return false;
+    }
+    if (is_header) {
+        put_header(f, source);
+    } else {
+        put_source(f, source, header);
+    }
+    ok = !ferror(f);
+    ok &= !fclose(f);
+    if (!ok) {
+        perror(name);
+        remove(name);
+    }
+    return ok;
+}
+
+// Write one language's catalog as a binary catalog file, removing it
+// if that fails.
+static bool write_binary(const char *name, const char *language)
+{
+    struct cobaro_log_catalog_header header;
+    struct cobaro_log_catalog_entry entry;
+    uint64_t offset;
+    int j;
+    FILE *f;
+    bool ok;
+
+    for (j = 0; j < languages_count; j++) {
+        if (!strcmp(languages[j], language)) {
+            break;
+        }
+    }
+    if (j == languages_count) {
+        fprintf(stderr, "%s: no language %s\n", path, language);
+        return false;
+    }
+
+    // Templates follow the header and entries.
+    offset = sizeof(header) + (uint64_t)messages_count * sizeof(entry);
+    for (int i = 0; i < messages_count; i++) {
+        offset += strlen(messages[i].templates[j]) + 1;
+    }
+    if (offset > UINT32_MAX) {
+        fprintf(stderr, "%s: catalog too large\n", path);
+        return false;
+    }
+
+    if (!(f = fopen(name, "wb"))) {
+        perror(name);
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COBARO_LOG_CATALOG_MAGIC, sizeof(header.magic));
+    header.version = COBARO_LOG_CATALOG_VERSION;
+    header.count = messages_count;
+    header.size = offset;
+    fwrite(&header, sizeof(header), 1, f);
+
+    offset = sizeof(header) + (uint64_t)messages_count * sizeof(entry);
+    for (int i = 0; i < messages_count; i++) {
+        entry.offset = offset;
+        entry.length = strlen(messages[i].templates[j]);
+        // Templates must use every parameter.
+        entry.used = (1u << messages[i].count) - 1;
+        fwrite(&entry, sizeof(entry), 1, f);
+        offset += entry.length + 1;
+    }
+    for (int i = 0; i < messages_count; i++) {
+        fwrite(messages[i].templates[j],
+               strlen(messages[i].templates[j]) + 1, 1, f);
+    }
+
+    ok = !ferror(f);
+    ok &= !fclose(f);
+    if (!ok) {
+        perror(name);
+        remove(name);
+    }
+    return ok;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s definitions header source\n"
+            "       %s --binary definitions language catalog\n",
+            argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *source;
+    bool binary;
+    FILE *f;
+
+    binary = argc > 1 && !strcmp(argv[1], "--binary");
+    if (argc != 4 + binary) {
+        usage(argv[0]);
+        return argc == 2 && !strcmp(argv[1], "-h") ? 0 : 1;
+    }
+
+    path = argv[1 + binary];
+    if (!(f = fopen(path, "r"))) {
+        perror(path);
+        return 1;
+    }
+    parse(f);
+    fclose(f);
+
+    if (binary) {
+        return write_binary(argv[4], argv[3]) ? 0 : 1;
+    }
+
+    // Name just the file, so output doesn't depend on the build directory.
+    source = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (!write_file(argv[2], source, argv[2], true) ||
+        !write_file(argv[3], source, argv[2], false)) {
+        return 1;
+    }
+    return 0;
+}